@@ -4,11 +4,14 @@ The allocators are divided into 3 categories:
     2. Strategies.  Things that manage memory.
     3. Compositors. Things that combine allocators and strategies.
 
-There are 4 allocators:
+There are 7 allocators:
     1. System allocator - Asks the OS for dynamic memory.
     2. Stack allocator  - Use the stack. This is special since it is also a strategy.
     3. Null allocator   - Always return null.
     4. Panic allocator  - Always crashes.
+    5. Large allocator  - Maps each allocation directly from the OS.
+    6. Fiber allocator  - Maps fixed-size stacks with guard pages and caches them.
+    7. I/O pool         - Maps one region of page-aligned buffers for direct I/O.
 
 After we got memory, there are different strategies of handling that memory:
     1. Bump/Arena - Useful for temporary allocations.
@@ -50,10 +53,15 @@ These can be combined with:
 #include "preamble.h"
 #include <stdlib.h>
 #include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #define ALIGN_OF(type) offsetof(struct { char c; type member; }, member)
 #define DO_ONCE(x) do { static int first_time = 1; if (first_time) { x; first_time = 0; } } while (0)
 
+#define CACHE_LINE_SIZE 64
+
 
 int is_power_of_two(u64 value) {
     return value && ((value & (value - 1)) == 0);
@@ -66,6 +74,13 @@ size_t align_address(size_t address, size_t alignment) {
     return aligned_address;
 }
 
+// The largest power of two that divides `address`, but at most `maximum`.
+size_t address_alignment(size_t address, size_t maximum) {
+    ASSERT(is_power_of_two(maximum));
+    size_t alignment = address & -address;
+    return (alignment == 0 || alignment > maximum) ? maximum : alignment;
+}
+
 word_t round_to_aligned(word_t size, word_t alignment) {
     ASSERT(size > 0);
     return size + (alignment - 1) & -alignment;
@@ -82,7 +97,7 @@ word_t alignment_padding(word_t size, word_t alignment) {
 typedef struct {
     const char* file;
     const char* function;
-    const int   line;
+    int         line;
 } source_location_t;
 
 
@@ -144,6 +159,13 @@ typedef enum {
     // Asks an allocator what its smallest manageable allocation size is. Many allocators
     // will align or pad, so this value tells the user for which size most memory is utilized.
     QUERY_GOOD_SIZE,
+
+    // Asks an allocator how many bytes an ALLOCATE_ALIGNED of `size` and `alignment` would
+    // actually get, all of which may be used. 0 if it can never allocate that.
+    QUERY_ALLOCATION_SIZE,
+
+    // Asks an allocator how many bytes of an existing allocation may be used.
+    QUERY_USABLE_SIZE,
 } allocation_mode_t;
 
 
@@ -215,7 +237,14 @@ typedef struct {
         struct {
             const byte_t* memory;
         } owns;
+
+        struct {
+            const byte_t* memory;
+        } usable_size;
     };
+
+    // Where the outermost request was made, filled in by `allocation_proxy`.
+    source_location_t location;
 } allocation_arguments_t;
 
 typedef allocation_result_t (*allocator_fn)(void* allocator, allocation_arguments_t arguments);
@@ -228,9 +257,21 @@ typedef struct {
 
 
 
+// Where the outermost request in progress on this thread was made. Compositors make their own
+// `nax_*` calls to their children, which then carry the caller's location instead of their own.
+static __thread source_location_t allocation_caller_location = { 0 };
+
 static inline allocation_result_t allocation_proxy(allocator_t allocator, allocation_arguments_t arguments, source_location_t location) {
     // @TODO: Add pre-post function calls.
+    if (allocation_caller_location.file != 0) {
+        arguments.location = allocation_caller_location;
+        return allocator.procedure(allocator.data, arguments);
+    }
+
+    arguments.location = location;
+    allocation_caller_location = location;
     allocation_result_t result = allocator.procedure(allocator.data, arguments);
+    allocation_caller_location = (source_location_t) { 0 };
     return result;
 }
 
@@ -248,6 +289,8 @@ static inline allocation_result_t allocation_proxy(allocator_t allocator, alloca
 #define nax_query_capacity(allocator)                        allocation_proxy(allocator, (allocation_arguments_t) { .mode=QUERY_CAPACITY,    },                                                                              (source_location_t) { .file=__FILE__, .function=__FUNCTION__, .line=__LINE__ }).result
 #define nax_query_alignment(allocator)                       allocation_proxy(allocator, (allocation_arguments_t) { .mode=QUERY_ALIGNMENT,   },                                                                              (source_location_t) { .file=__FILE__, .function=__FUNCTION__, .line=__LINE__ }).result
 #define nax_query_good_size(allocator)                       allocation_proxy(allocator, (allocation_arguments_t) { .mode=QUERY_GOOD_SIZE,   },                                                                              (source_location_t) { .file=__FILE__, .function=__FUNCTION__, .line=__LINE__ }).result
+#define nax_query_allocation_size(allocator, size_, alignment_) allocation_proxy(allocator, (allocation_arguments_t) { .mode=QUERY_ALLOCATION_SIZE, .allocate_aligned={ .size=size_, .alignment=alignment_ }},                     (source_location_t) { .file=__FILE__, .function=__FUNCTION__, .line=__LINE__ }).result
+#define nax_query_usable_size(allocator, memory_)               allocation_proxy(allocator, (allocation_arguments_t) { .mode=QUERY_USABLE_SIZE, .usable_size={ .memory=memory_ }},                                              (source_location_t) { .file=__FILE__, .function=__FUNCTION__, .line=__LINE__ }).result
 
 
 
@@ -268,6 +311,9 @@ allocation_result_t allocator_null_proc(void* allocator, allocation_arguments_t
         case FREE:             return (arguments.free.memory     == 0) ? make_free_status(FREE_STATUS_SUCCEEDED) : make_free_status(FREE_STATUS_CALLED_ON_NON_OWNED_MEMORY);
         case FREE_ALL:         return make_free_status(FREE_STATUS_SUCCEEDED);
         case QUERY_OWNS:       return make_query_result(arguments.owns.memory == 0);
+        case QUERY_ALLOCATION_SIZE:
+        case QUERY_USABLE_SIZE:
+            return make_query_result(0);
 
         // @NOTE: Unsupported.
         case QUERY_CAPACITY:
@@ -283,6 +329,20 @@ allocation_result_t allocator_panic_proc(__attribute__((unused)) void* allocator
     return (allocation_result_t) { 0 };
 }
 
+// What malloc guarantees on its own, anything above goes through posix_memalign.
+#define MALLOC_ALIGNMENT 16
+
+// The chunk layout of glibc's malloc on 64-bit targets, which QUERY_ALLOCATION_SIZE predicts.
+#if defined(__GLIBC__) && UINTPTR_MAX == UINT64_MAX
+    #define MALLOC_CHUNK_LAYOUT_KNOWN   1
+    #define MALLOC_CHUNK_HEADER         8             // The size field in front of every chunk.
+    #define MALLOC_CHUNK_ROUNDING       16            // Chunks are multiples of this.
+    #define MALLOC_CHUNK_MINIMUM        32            // Large enough for the free list links.
+    #define MALLOC_MMAP_THRESHOLD       (128 * 1024)  // The default, above which chunks are mapped.
+#else
+    #define MALLOC_CHUNK_LAYOUT_KNOWN   0
+#endif
+
 allocation_result_t allocator_malloc_proc(__attribute__((unused)) void* allocator, allocation_arguments_t arguments) {
     switch (arguments.mode) {
         case ALLOCATE: {
@@ -296,7 +356,12 @@ allocation_result_t allocator_malloc_proc(__attribute__((unused)) void* allocato
         }
         case ALLOCATE_ALIGNED: {
             word_t  aligned_size = round_to_aligned(arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
-            byte_t* memory = (byte_t*) malloc((size_t) aligned_size);
+            byte_t* memory = 0;
+            if ((size_t) arguments.allocate_aligned.alignment <= MALLOC_ALIGNMENT) {
+                memory = (byte_t*) malloc((size_t) aligned_size);
+            } else if (posix_memalign((void**) &memory, (size_t) arguments.allocate_aligned.alignment, (size_t) aligned_size) != 0) {
+                memory = 0;
+            }
             if (memory != 0) {
                 memset(memory, 0xCC, (size_t) aligned_size);
                 return make_allocation_result(memory);
@@ -308,7 +373,9 @@ allocation_result_t allocator_malloc_proc(__attribute__((unused)) void* allocato
             word_t  aligned_size = round_to_aligned(arguments.resize.new_size, 8);  // @TODO: Get alignment from memory address.
             byte_t* memory = (byte_t*) realloc(arguments.resize.memory, (size_t) aligned_size);
             if (memory != 0) {
-                memset(memory, 0xCC, (size_t) aligned_size);
+                word_t old_size = (arguments.resize.memory == 0) ? 0 : arguments.resize.old_size;
+                if (aligned_size > old_size)
+                    memset(memory + old_size, 0xCC, (size_t) (aligned_size - old_size));
                 return make_allocation_result(memory);
             } else {
                 return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
@@ -318,15 +385,42 @@ allocation_result_t allocator_malloc_proc(__attribute__((unused)) void* allocato
             free(arguments.free.memory);
             return make_free_status(FREE_STATUS_SUCCEEDED);
         }
+#if MALLOC_CHUNK_LAYOUT_KNOWN
+        // @NOTE: A chunk of `size` plus the header is rounded up, but to no less than the minimum,
+        //        and all of it but the header can be used. Above the mmap threshold it's the size
+        //        itself, as the threshold moves at runtime, and so it is for posix_memalign, which
+        //        may split chunks.
+        case QUERY_ALLOCATION_SIZE: {
+            word_t size         = (arguments.allocate_aligned.size > 0)      ? arguments.allocate_aligned.size      : 1;
+            word_t alignment    = (arguments.allocate_aligned.alignment > 0) ? arguments.allocate_aligned.alignment : 1;
+            size_t aligned_size = (size_t) round_to_aligned(size, alignment);
+            if (aligned_size >= MALLOC_MMAP_THRESHOLD || (size_t) alignment > MALLOC_ALIGNMENT)
+                return make_query_result(aligned_size);
+            size_t chunk = align_address(aligned_size + MALLOC_CHUNK_HEADER, MALLOC_CHUNK_ROUNDING);
+            return make_query_result(((chunk < MALLOC_CHUNK_MINIMUM) ? MALLOC_CHUNK_MINIMUM : chunk) - MALLOC_CHUNK_HEADER);
+        }
+#else
+        case QUERY_ALLOCATION_SIZE:
+            return make_query_result(ALLOCATION_QUERY_UNSUPPORTED);
+#endif
+#ifdef __GLIBC__
+        case QUERY_USABLE_SIZE:
+            return make_query_result(arguments.usable_size.memory == 0 ? 0 : malloc_usable_size((void*) arguments.usable_size.memory));
+#else
+        case QUERY_USABLE_SIZE:
+            return make_query_result(ALLOCATION_QUERY_UNSUPPORTED);
+#endif
 
         // @NOTE: Unsupported.
         case ALLOCATE_ALL:
         case FREE_ALL:
             return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
 
+        case QUERY_ALIGNMENT:
+            return make_query_result(MALLOC_ALIGNMENT);
+
         case QUERY_OWNS:
         case QUERY_CAPACITY:
-        case QUERY_ALIGNMENT:
         case QUERY_GOOD_SIZE:
         case QUERY_USED:
             return make_query_result(ALLOCATION_QUERY_UNSUPPORTED);
@@ -340,15 +434,34 @@ static allocator_t allocator_null    = { .procedure=allocator_null_proc,   .data
 static allocator_t allocator_panic   = { .procedure=allocator_panic_proc,  .data=0 };
 static allocator_t allocator_malloc  = { .procedure=allocator_malloc_proc, .data=0 };
 
+#include "large.c"
+#include "fiber.c"
+#include "iopool.c"
+
 
 /* ---- ALLOCATORS STRATEGIES ---- */
 #include "stack.c"
 #include "freelist.c"
+#include "persistent.c"
+#include "concurrent.c"
 
 
 /* ---- ALLOCATORS COMPOSITORS ---- */
 #include "fallback.c"
 #include "segregator.c"
+#include "exclusive.c"
+#include "epoch.c"
+#include "profiler.c"
+
+
+/* ---- SCAVENGER ---- */
+#include "scavenger.c"
+
+
+/* ---- CONTAINERS ---- */
+#include "array.c"
+#include "table.c"
+#include "interner.c"
 
 
 
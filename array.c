@@ -0,0 +1,196 @@
+/* A growable array that gets its memory from an `allocator_t`.
+ *
+ * It grows by a factor of 1.5 rather than 2. Below the golden ratio the blocks freed by
+ * earlier growths eventually add up to enough memory for the next one, so the allocator
+ * gets a chance to reuse them (see discussion.txt). It shrinks by half only once the count
+ * has dropped to a quarter of the capacity, so pushing and popping around a boundary
+ * doesn't reallocate every time.
+ *
+ * Growing and shrinking tries RESIZE first, which is in place for e.g. the top of a stack
+ * allocator. RESIZE takes no alignment, so a block it moves to a less aligned address is moved
+ * again by hand. The capacity grows into whatever QUERY_ALLOCATION_SIZE says the allocation
+ * will really get, since that memory would be handed out anyway.
+ */
+#define ARRAY_GROWTH_NUMERATOR    3
+#define ARRAY_GROWTH_DENOMINATOR  2
+#define ARRAY_MINIMUM_CAPACITY    8
+
+
+typedef struct {
+    allocator_t allocator;
+    byte_t* m_memory;
+    u32     m_count;
+    u32     m_capacity;
+    u32     m_size;          // Size of the allocation, which may be more than the capacity needs.
+    u32     m_element_size;
+    u32     m_alignment;
+} array_t;
+
+// A byte buffer is just an array of bytes.
+typedef array_t buffer_t;
+
+
+array_t array_init(allocator_t allocator, u32 element_size, u32 alignment) {
+    ASSERTF(element_size > 0, "Element size must be positive!");
+    ASSERTF(is_power_of_two(alignment), "Alignment must be a power of two!");
+    return (array_t) {
+            .allocator      = allocator,
+            .m_memory       = 0,
+            .m_count        = 0,
+            .m_capacity     = 0,
+            .m_size         = 0,
+            .m_element_size = element_size,
+            .m_alignment    = alignment,
+    };
+}
+
+#define array_init_type(allocator, type_) array_init(allocator, sizeof(type_), ALIGN_OF(type_))
+#define array_at(array, type_, index)     (((type_*) (array)->m_memory)[index])
+
+
+// How much an allocation of `size` really gets. Allocators without QUERY_ALLOCATION_SIZE are
+// assumed to round up to a multiple of their good size.
+word_t array_good_size(array_t* array, word_t size) {
+    size_t allocation_size = nax_query_allocation_size(array->allocator, size, (word_t) array->m_alignment);
+    if (allocation_size != ALLOCATION_QUERY_UNSUPPORTED && allocation_size >= (size_t) size) {
+        return (word_t) allocation_size;
+    }
+
+    size_t good_size = nax_query_good_size(array->allocator);
+    if (good_size == ALLOCATION_QUERY_UNSUPPORTED || good_size <= 1) {
+        return size;
+    }
+    return (word_t) (((size_t) size + good_size - 1) / good_size * good_size);
+}
+
+
+allocation_result_t array_set_capacity(array_t* array, u32 capacity) {
+    ASSERTF(capacity >= array->m_count, "Capacity must fit the elements!");
+    word_t old_size = array->m_size;
+
+    if (capacity == 0) {
+        if (array->m_memory != 0) {
+            nax_free(array->allocator, array->m_memory);
+        }
+        array->m_memory   = 0;
+        array->m_capacity = 0;
+        array->m_size     = 0;
+        return (allocation_result_t) { .memory=0 };
+    }
+
+    word_t  new_size = array_good_size(array, (word_t) capacity * array->m_element_size);
+    byte_t* memory   = 0;
+    if (array->m_memory == 0) {
+        memory = nax_allocate_aligned(array->allocator, new_size, array->m_alignment);
+    } else {
+        memory = nax_resize(array->allocator, array->m_memory, new_size, old_size);
+        if ((size_t) memory == ALLOCATION_STATUS_UNSUPPORTED_OPERATION) {
+            // The allocator can't resize at all, so do it by hand.
+            memory = nax_allocate_aligned(array->allocator, new_size, array->m_alignment);
+            if (allocation_succeeded(memory)) {
+                memcpy(memory, array->m_memory, (size_t) array->m_count * array->m_element_size);
+                nax_free(array->allocator, array->m_memory);
+            }
+        } else if (allocation_succeeded(memory) && (size_t) memory % array->m_alignment != 0) {
+            // RESIZE moved the block with only the allocator's default alignment, so move it again.
+            // If that fails the elements stay where RESIZE put them and the error is returned.
+            byte_t* aligned = nax_allocate_aligned(array->allocator, new_size, array->m_alignment);
+            if (!allocation_succeeded(aligned)) {
+                array->m_memory   = memory;
+                array->m_capacity = (u32) (new_size / array->m_element_size);
+                array->m_size     = (u32) new_size;
+                return make_allocation_error((allocation_status_t)(size_t) aligned);
+            }
+            memcpy(aligned, memory, (size_t) array->m_count * array->m_element_size);
+            nax_free(array->allocator, memory);
+            memory = aligned;
+        }
+    }
+
+    if (!allocation_succeeded(memory)) {
+        return make_allocation_error((allocation_status_t)(size_t) memory);
+    }
+
+    array->m_memory   = memory;
+    array->m_capacity = (u32) (new_size / array->m_element_size);
+    array->m_size     = (u32) new_size;
+    return make_allocation_result(memory);
+}
+
+
+allocation_result_t array_reserve(array_t* array, u32 count) {
+    if (count <= array->m_capacity) {
+        return (allocation_result_t) { .memory=array->m_memory };
+    }
+
+    u32 capacity = array->m_capacity / ARRAY_GROWTH_DENOMINATOR * ARRAY_GROWTH_NUMERATOR;
+    if (capacity < ARRAY_MINIMUM_CAPACITY)
+        capacity = ARRAY_MINIMUM_CAPACITY;
+    if (capacity < count)
+        capacity = count;
+
+    return array_set_capacity(array, capacity);
+}
+
+
+// Appends `count` elements, copied from `elements` if it's not null. Returns the first new element.
+allocation_result_t array_append(array_t* array, const void* elements, u32 count) {
+    allocation_result_t result = array_reserve(array, array->m_count + count);
+    if (!allocation_succeeded(result.memory)) {
+        return result;
+    }
+
+    byte_t* destination = array->m_memory + (size_t) array->m_count * array->m_element_size;
+    if (elements != 0) {
+        memcpy(destination, elements, (size_t) count * array->m_element_size);
+    }
+    array->m_count += count;
+    return make_allocation_result(destination);
+}
+
+allocation_result_t array_push(array_t* array, const void* element) {
+    if (array->m_count < array->m_capacity) {
+        byte_t* destination = array->m_memory + (size_t) array->m_count * array->m_element_size;
+        memcpy(destination, element, array->m_element_size);
+        array->m_count += 1;
+        return (allocation_result_t) { .memory=destination };
+    }
+    return array_append(array, element, 1);
+}
+
+
+// Removes the last `count` elements and halves the capacity for as long as only a quarter of it is used.
+void array_pop(array_t* array, u32 count) {
+    ASSERTF(count <= array->m_count, "Popping more elements than the array has!");
+    array->m_count -= count;
+
+    u32 capacity = array->m_capacity;
+    while (array->m_count <= capacity / 4 && capacity / 2 >= ARRAY_MINIMUM_CAPACITY) {
+        capacity /= 2;
+    }
+    if (capacity != array->m_capacity) {
+        allocation_result_t result = array_set_capacity(array, capacity);
+        // A failed shrink leaves the array as it was, which is fine.
+        (void) result;
+    }
+}
+
+
+void array_clear(array_t* array) {
+    array_pop(array, array->m_count);
+}
+
+
+void array_free(array_t* array) {
+    array->m_count = 0;
+    array_set_capacity(array, 0);
+}
+
+
+buffer_t buffer_init(allocator_t allocator) {
+    return array_init(allocator, 1, 1);
+}
+
+allocation_result_t buffer_append(buffer_t* buffer, const void* bytes, u32 size) {
+    return array_append(buffer, bytes, size);
+}
@@ -0,0 +1,1268 @@
+#include "allocator.c"
+#include <fcntl.h>
+#include <time.h>
+#include <ucontext.h>
+
+
+f64 benchmark_now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (f64) time.tv_sec + (f64) time.tv_nsec * 1e-9;
+}
+
+// Small deterministic generator so every run does the same work.
+u32 benchmark_random(u64* state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (u32) (*state >> 33);
+}
+
+
+/* ---- ARRAY ---- */
+#define ARRAY_CHURN_ROUNDS   20000
+#define ARRAY_CHURN_MAXIMUM  (64 * 1024)
+#define ARRAY_CHURN_CHUNK    256
+
+// Appends chunks up to a random count and then pops down to a random smaller count, over and over.
+f64 benchmark_array_churn(allocator_t allocator, u64* checksum) {
+    u64 state = 42;
+    u32 chunk[ARRAY_CHURN_CHUNK];
+    for (u32 i = 0; i < ARRAY_CHURN_CHUNK; ++i)
+        chunk[i] = i;
+
+    array_t array = array_init_type(allocator, u32);
+
+    f64 start = benchmark_now();
+    for (int round = 0; round < ARRAY_CHURN_ROUNDS; ++round) {
+        u32 grow_to = benchmark_random(&state) % ARRAY_CHURN_MAXIMUM;
+        while (array.m_count < grow_to) {
+            u32 count = 1 + benchmark_random(&state) % ARRAY_CHURN_CHUNK;
+            array_append(&array, chunk, count);
+        }
+        u32 shrink_to = benchmark_random(&state) % (array.m_count + 1);
+        if (array.m_count > 0)
+            *checksum += array_at(&array, u32, array.m_count - 1);
+        array_pop(&array, array.m_count - shrink_to);
+    }
+    f64 elapsed = benchmark_now() - start;
+
+    array_free(&array);
+    return elapsed;
+}
+
+// The same work with the usual doubling realloc and no shrinking.
+f64 benchmark_realloc_churn(u64* checksum) {
+    u64 state = 42;
+    u32 chunk[ARRAY_CHURN_CHUNK];
+    for (u32 i = 0; i < ARRAY_CHURN_CHUNK; ++i)
+        chunk[i] = i;
+
+    u32* elements = 0;
+    u32  count    = 0;
+    u32  capacity = 0;
+
+    f64 start = benchmark_now();
+    for (int round = 0; round < ARRAY_CHURN_ROUNDS; ++round) {
+        u32 grow_to = benchmark_random(&state) % ARRAY_CHURN_MAXIMUM;
+        while (count < grow_to) {
+            u32 chunk_count = 1 + benchmark_random(&state) % ARRAY_CHURN_CHUNK;
+            while (count + chunk_count > capacity) {
+                capacity = (capacity == 0) ? ARRAY_MINIMUM_CAPACITY : capacity * 2;
+                elements = (u32*) realloc(elements, capacity * sizeof(u32));
+                ASSERT(elements != 0);
+            }
+            memcpy(elements + count, chunk, chunk_count * sizeof(u32));
+            count += chunk_count;
+        }
+        u32 shrink_to = benchmark_random(&state) % (count + 1);
+        if (count > 0)
+            *checksum += elements[count - 1];
+        count = shrink_to;
+    }
+    f64 elapsed = benchmark_now() - start;
+
+    free(elements);
+    return elapsed;
+}
+
+void benchmark_array(void) {
+    printf("---- Array grow/shrink churn (%d rounds, up to %d elements) ----\n", ARRAY_CHURN_ROUNDS, ARRAY_CHURN_MAXIMUM);
+
+    u64 checksum_realloc = 0;
+    f64 time_realloc = benchmark_realloc_churn(&checksum_realloc);
+    printf("realloc x2         %8.3f ms\n", time_realloc * 1000.0);
+
+    u64 checksum_malloc = 0;
+    f64 time_malloc = benchmark_array_churn(allocator_malloc, &checksum_malloc);
+    printf("array_t on malloc  %8.3f ms\n", time_malloc * 1000.0);
+
+    // The array is the only allocation, so every RESIZE happens in place at the top of the stack.
+    u32 capacity = (ARRAY_CHURN_MAXIMUM + ARRAY_CHURN_CHUNK) * sizeof(u32) * 2;
+    byte_t* memory = (byte_t*) malloc(capacity);
+    allocator_stack_t stack_alloc = allocator_stack_init(memory, capacity);
+    allocator_t stack = { allocator_stack_proc, &stack_alloc };
+
+    u64 checksum_stack = 0;
+    f64 time_stack = benchmark_array_churn(stack, &checksum_stack);
+    printf("array_t on stack   %8.3f ms\n", time_stack * 1000.0);
+    free(memory);
+
+    ASSERT(checksum_realloc == checksum_malloc && checksum_malloc == checksum_stack);
+}
+
+
+/* ---- LARGE ---- */
+#define LARGE_GROWTH_STEP     (256 * 1024)
+#define LARGE_GROWTH_MAXIMUM  (64 * 1024 * 1024)
+
+// Grows a buffer by a fixed step with RESIZE, writing the new part, like a receive buffer would.
+f64 benchmark_large_growth(allocator_t allocator) {
+    f64 start = benchmark_now();
+
+    byte_t* buffer = 0;
+    word_t  size   = 0;
+    while (size < LARGE_GROWTH_MAXIMUM) {
+        buffer = nax_resize(allocator, buffer, size + LARGE_GROWTH_STEP, size);
+        ASSERT(allocation_succeeded(buffer) && buffer != 0);
+        memset(buffer + size, (int) (size / LARGE_GROWTH_STEP), LARGE_GROWTH_STEP);
+        size += LARGE_GROWTH_STEP;
+    }
+    ASSERT(buffer[size - 1] == (byte_t) (size / LARGE_GROWTH_STEP - 1));
+    nax_free(allocator, buffer);
+
+    return benchmark_now() - start;
+}
+
+void benchmark_large(void) {
+    printf("---- Large buffer growth (%d KiB steps up to %d MiB) ----\n", LARGE_GROWTH_STEP / 1024, LARGE_GROWTH_MAXIMUM / (1024 * 1024));
+
+    f64 time_malloc = benchmark_large_growth(allocator_malloc);
+    printf("malloc (realloc)   %8.3f ms\n", time_malloc * 1000.0);
+
+    allocator_large_t large_alloc = large_init();
+    allocator_t large = { allocator_large_proc, &large_alloc };
+    f64 time_large = benchmark_large_growth(large);
+    printf("large (mremap)     %8.3f ms\n", time_large * 1000.0);
+    ASSERT(nax_query_used(large) == 0);
+
+    // Small allocations in a freelist, everything above a block in the large allocator.
+    byte_t* memory = (byte_t*) malloc(64 * 1024);
+    allocator_freelist_t freelist = freelist_init(memory, 64, 1024);
+    allocator_segregator_t segregator_alloc = { { allocator_freelist_proc, &freelist }, large, 64, 0 };
+    allocator_t segregator = { allocator_segregator_proc, &segregator_alloc };
+    f64 time_segregator = benchmark_large_growth(segregator);
+    printf("freelist | large   %8.3f ms\n", time_segregator * 1000.0);
+    free(memory);
+    large_destroy(&large_alloc);
+}
+
+
+/* ---- PROFILER ---- */
+#define PROFILER_OPERATIONS  (4 * 1000 * 1000)
+#define PROFILER_LIVE        1024
+
+// Allocates and frees random small sizes, keeping a window of live allocations.
+f64 benchmark_profiler_churn(allocator_t allocator) {
+    u64 state = 42;
+    byte_t* live[PROFILER_LIVE] = { 0 };
+
+    f64 start = benchmark_now();
+    for (int i = 0; i < PROFILER_OPERATIONS; ++i) {
+        u32 slot = benchmark_random(&state) % PROFILER_LIVE;
+        if (live[slot] != 0)
+            nax_free(allocator, live[slot]);
+        live[slot] = nax_allocate(allocator, 16 + benchmark_random(&state) % 512);
+    }
+    for (u32 slot = 0; slot < PROFILER_LIVE; ++slot) {
+        if (live[slot] != 0)
+            nax_free(allocator, live[slot]);
+    }
+    return benchmark_now() - start;
+}
+
+void benchmark_profiler(void) {
+    printf("---- Sampling profiler overhead (%d allocations) ----\n", PROFILER_OPERATIONS);
+
+    f64 time_malloc = benchmark_profiler_churn(allocator_malloc);
+    printf("malloc             %8.3f ms\n", time_malloc * 1000.0);
+
+    allocator_profiler_t* profiler_alloc = (allocator_profiler_t*) malloc(sizeof(allocator_profiler_t));
+    profiler_init(profiler_alloc, allocator_malloc, 512 * 1024);
+    allocator_t profiler = { allocator_profiler_proc, profiler_alloc };
+    f64 time_profiler = benchmark_profiler_churn(profiler);
+    printf("profiled malloc    %8.3f ms\n", time_profiler * 1000.0);
+
+    profiler_report(profiler_alloc, stdout);
+    free(profiler_alloc);
+}
+
+
+/* ---- ADAPTIVE SEGREGATOR ---- */
+#define SEGREGATOR_OPERATIONS  (1000 * 1000)
+#define SEGREGATOR_LIVE        2048
+
+// Random sizes in [minimum, maximum] with a window of live allocations. Returns the fraction served by the primary.
+f64 benchmark_segregator_phase(allocator_t allocator, allocator_t primary, byte_t** live, word_t minimum, word_t maximum, u64* state) {
+    u32 hits = 0;
+    for (int i = 0; i < SEGREGATOR_OPERATIONS; ++i) {
+        u32 slot = benchmark_random(state) % SEGREGATOR_LIVE;
+        if (live[slot] != 0)
+            nax_free(allocator, live[slot]);
+        live[slot] = nax_allocate(allocator, minimum + (word_t) (benchmark_random(state) % (u32) (maximum - minimum + 1)));
+        ASSERT(allocation_succeeded(live[slot]));
+        hits += nax_query_owns(primary, live[slot]) == 1;
+    }
+    return (f64) hits / SEGREGATOR_OPERATIONS;
+}
+
+void benchmark_segregator_run(const char* name, int adaptive) {
+    u32 block_size = 256;
+    u32 count      = 1024;
+    byte_t* memory = (byte_t*) malloc(block_size * count);
+    allocator_freelist_t freelist = freelist_init(memory, block_size, count);
+    allocator_t primary = { allocator_freelist_proc, &freelist };
+
+    // The fixed segregator needs a fallback, as a full primary otherwise fails the allocation.
+    allocator_fallback_t fallback = { primary, allocator_malloc };
+    allocator_t fixed_primary = { allocator_fallback_proc, &fallback };
+
+    segregator_adaptive_t adaptive_state = segregator_adaptive_init(block_size, 16 * 1024);
+    allocator_segregator_t segregator_alloc = { adaptive ? primary : fixed_primary, allocator_malloc, 64, adaptive ? &adaptive_state : 0 };
+    allocator_t segregator = { allocator_segregator_proc, &segregator_alloc };
+
+    u64 state = 42;
+    byte_t** live = (byte_t**) calloc(SEGREGATOR_LIVE, sizeof(byte_t*));
+    f64 small  = benchmark_segregator_phase(segregator, primary, live, 8,   64,  &state);
+    word_t after_small = segregator_alloc.threshold;
+    f64 medium = benchmark_segregator_phase(segregator, primary, live, 100, 256, &state);
+    segregator_decision_t decision = segregator_query_decision(&segregator_alloc);
+    printf("%-18s primary hits %5.1f%% then %5.1f%%, threshold %d then %d (%u decisions)\n",
+           name, small * 100.0, medium * 100.0, (int) after_small, (int) decision.threshold, decision.decisions);
+
+    for (u32 slot = 0; slot < SEGREGATOR_LIVE; ++slot) {
+        if (live[slot] != 0)
+            nax_free(segregator, live[slot]);
+    }
+    free(live);
+    free(memory);
+}
+
+void benchmark_segregator(void) {
+    printf("---- Segregator with 1024 x 256 byte freelist primary (sizes 8-64, then 100-256) ----\n");
+    benchmark_segregator_run("fixed threshold",    0);
+    benchmark_segregator_run("adaptive threshold", 1);
+}
+
+
+/* ---- SCAVENGER ---- */
+#define SCAVENGER_REGION  (64 * 1024 * 1024)
+#define SCAVENGER_IDLE    0.05
+
+// Resident bytes of a mapping, from mincore.
+size_t benchmark_resident(byte_t* region, size_t size) {
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t pages     = size / page_size;
+    unsigned char* vector = (unsigned char*) malloc(pages);
+    mincore(region, size, vector);
+    size_t resident = 0;
+    for (size_t i = 0; i < pages; ++i)
+        resident += vector[i] & 1;
+    free(vector);
+    return resident * page_size;
+}
+
+void benchmark_scavenger(void) {
+    printf("---- Scavenger (%d MiB stack and freelist, idle %.0f ms) ----\n", SCAVENGER_REGION / (1024 * 1024), SCAVENGER_IDLE * 1000.0);
+
+    byte_t* stack_memory    = (byte_t*) mmap(0, SCAVENGER_REGION, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    byte_t* freelist_memory = (byte_t*) mmap(0, SCAVENGER_REGION, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT(stack_memory != MAP_FAILED && freelist_memory != MAP_FAILED);
+
+    allocator_stack_t    stack_alloc    = allocator_stack_init(stack_memory, SCAVENGER_REGION);
+    allocator_freelist_t freelist_alloc = freelist_init(freelist_memory, 4096, SCAVENGER_REGION / 4096);
+    allocator_t stack    = { allocator_stack_proc,    &stack_alloc };
+    allocator_t freelist = { allocator_freelist_proc, &freelist_alloc };
+
+    // A burst up to the whole region, after which only a sixteenth stays in use: the start of the
+    // stack, and every sixteenth block of the freelist, so its free memory is all between blocks in use.
+    static byte_t* blocks[SCAVENGER_REGION / 4096];
+    u32 count = SCAVENGER_REGION / 4096;
+    for (u32 i = 0; i < count; ++i) {
+        blocks[i] = nax_allocate(freelist, 4096);
+        memset(blocks[i], (int) i, 4096);
+    }
+    for (u32 i = 0; i < count; ++i) {
+        if (i % 16 != 0)
+            nax_free(freelist, blocks[i]);
+    }
+    byte_t* burst = nax_allocate(stack, SCAVENGER_REGION);
+    memset(burst, 1, SCAVENGER_REGION);
+    nax_free_all(stack);
+    byte_t* kept = nax_allocate(stack, SCAVENGER_REGION / 16);
+    memset(kept, 2, SCAVENGER_REGION / 16);
+
+    scavenger_t scavenger;
+    scavenger_init(&scavenger, SCAVENGER_IDLE);
+    scavenger_register_stack(&scavenger, &stack_alloc, 0);
+    scavenger_register_freelist(&scavenger, &freelist_alloc, 0);
+
+    printf("after burst        stack %6.1f MiB, freelist %6.1f MiB resident\n",
+           (f64) benchmark_resident(stack_memory, SCAVENGER_REGION) / (1024 * 1024), (f64) benchmark_resident(freelist_memory, SCAVENGER_REGION) / (1024 * 1024));
+
+    scavenge(&scavenger);
+    struct timespec idle = { 0, (long) (SCAVENGER_IDLE * 1e9) };
+    nanosleep(&idle, 0);
+    f64 start = benchmark_now();
+    size_t released = scavenge(&scavenger);
+    f64 time_scavenge = benchmark_now() - start;
+    printf("after scavenge     stack %6.1f MiB, freelist %6.1f MiB resident (%.1f MiB released in %.3f ms)\n",
+           (f64) benchmark_resident(stack_memory, SCAVENGER_REGION) / (1024 * 1024), (f64) benchmark_resident(freelist_memory, SCAVENGER_REGION) / (1024 * 1024),
+           (f64) released / (1024 * 1024), time_scavenge * 1000.0);
+
+    // The released blocks are handed out again, and none of them overlaps a block in use.
+    for (u32 i = 0; i < count; ++i) {
+        if (i % 16 == 0)
+            continue;
+        blocks[i] = nax_allocate(freelist, 4096);
+        ASSERT(allocation_succeeded(blocks[i]) && blocks[i] != 0);
+        memset(blocks[i], 0xEE, 4096);
+    }
+    for (u32 i = 0; i < count; i += 16)
+        ASSERT(blocks[i][0] == (byte_t) i && blocks[i][4095] == (byte_t) i);
+    ASSERT(!allocation_succeeded(nax_allocate(freelist, 4096)));
+
+    scavenger_destroy(&scavenger);
+    munmap(stack_memory,    SCAVENGER_REGION);
+    munmap(freelist_memory, SCAVENGER_REGION);
+}
+
+
+/* ---- FIBER STACKS ---- */
+#define FIBER_STACK_SIZE  (256 * 1024)
+#define FIBER_COUNT       (100 * 1000)
+#define FIBER_TOUCHED     (16 * 1024)     // Stack each fiber actually uses.
+#define FIBER_LIVE        64
+
+static ucontext_t      benchmark_fiber_return;
+static volatile byte_t benchmark_fiber_sink;
+
+void benchmark_fiber_body(void) {
+    volatile byte_t frame[FIBER_TOUCHED];
+    for (u32 i = 0; i < FIBER_TOUCHED; i += 512)
+        frame[i] = (byte_t) i;
+    benchmark_fiber_sink = frame[FIBER_TOUCHED - 512];
+}
+
+void benchmark_fiber_run(byte_t* stack) {
+    ucontext_t fiber;
+    getcontext(&fiber);
+    fiber.uc_stack.ss_sp   = stack;
+    fiber.uc_stack.ss_size = FIBER_STACK_SIZE;
+    fiber.uc_link          = &benchmark_fiber_return;
+    makecontext(&fiber, benchmark_fiber_body, 0);
+    swapcontext(&benchmark_fiber_return, &fiber);
+}
+
+typedef byte_t* (*benchmark_stack_create_t)(void* data);
+typedef void    (*benchmark_stack_destroy_t)(void* data, byte_t* stack);
+
+byte_t* benchmark_mmap_stack_create(__attribute__((unused)) void* data) {
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    byte_t* mapping = (byte_t*) mmap(0, FIBER_STACK_SIZE + page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT(mapping != MAP_FAILED);
+    mprotect(mapping, page_size, PROT_NONE);
+    return mapping + page_size;
+}
+
+void benchmark_mmap_stack_destroy(__attribute__((unused)) void* data, byte_t* stack) {
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    munmap(stack - page_size, FIBER_STACK_SIZE + page_size);
+}
+
+byte_t* benchmark_allocator_stack_create(void* data) {
+    byte_t* stack = nax_allocate(*(allocator_t*) data, FIBER_STACK_SIZE);
+    ASSERT(allocation_succeeded(stack) && stack != 0);
+    return stack;
+}
+
+void benchmark_allocator_stack_destroy(void* data, byte_t* stack) {
+    nax_free(*(allocator_t*) data, stack);
+}
+
+// Creates, runs to completion and destroys fibers, keeping a window of stacks alive like a scheduler would.
+f64 benchmark_fiber_churn(benchmark_stack_create_t create, benchmark_stack_destroy_t destroy, void* data) {
+    u64 state = 42;
+    byte_t* live[FIBER_LIVE] = { 0 };
+
+    f64 start = benchmark_now();
+    for (int i = 0; i < FIBER_COUNT; ++i) {
+        u32 slot = benchmark_random(&state) % FIBER_LIVE;
+        if (live[slot] != 0)
+            destroy(data, live[slot]);
+        live[slot] = create(data);
+        benchmark_fiber_run(live[slot]);
+    }
+    for (u32 slot = 0; slot < FIBER_LIVE; ++slot) {
+        if (live[slot] != 0)
+            destroy(data, live[slot]);
+    }
+    return benchmark_now() - start;
+}
+
+void benchmark_fiber(void) {
+    printf("---- Fiber create/destroy (%d fibers, %d KiB stacks, %d live) ----\n", FIBER_COUNT, FIBER_STACK_SIZE / 1024, FIBER_LIVE);
+
+    allocator_t malloc_stacks = allocator_malloc;
+    f64 time_malloc = benchmark_fiber_churn(benchmark_allocator_stack_create, benchmark_allocator_stack_destroy, &malloc_stacks);
+    printf("malloc (no guard)  %8.3f ms  %8.0f fibers/s\n", time_malloc * 1000.0, FIBER_COUNT / time_malloc);
+
+    f64 time_mmap = benchmark_fiber_churn(benchmark_mmap_stack_create, benchmark_mmap_stack_destroy, 0);
+    printf("mmap + guard       %8.3f ms  %8.0f fibers/s\n", time_mmap * 1000.0, FIBER_COUNT / time_mmap);
+
+    allocator_fiber_t fiber_alloc;
+    ASSERT(fiber_init(&fiber_alloc, FIBER_STACK_SIZE, 1024, 16 * FIBER_STACK_SIZE));
+    allocator_t fiber = { allocator_fiber_proc, &fiber_alloc };
+    f64 time_pool = benchmark_fiber_churn(benchmark_allocator_stack_create, benchmark_allocator_stack_destroy, &fiber);
+    printf("fiber pool         %8.3f ms  %8.0f fibers/s\n", time_pool * 1000.0, FIBER_COUNT / time_pool);
+    printf("fiber pool         %u stacks mapped, %.1f MiB resident after all fibers ended\n",
+           fiber_alloc.m_untouched, (f64) benchmark_resident(fiber_alloc.m_region, fiber_alloc.m_region_size) / (1024 * 1024));
+    fiber_destroy(&fiber_alloc);
+}
+
+
+/* ---- RELATIVE POINTERS ---- */
+#define TREE_NODES    (1000 * 1000)
+#define TREE_LOOKUPS  (1000 * 1000)
+
+typedef struct pointer_node_t {
+    u32 key;
+    struct pointer_node_t* left;
+    struct pointer_node_t* right;
+} pointer_node_t;
+
+typedef struct {
+    u32                 key;
+    freelist_relative_t left;
+    freelist_relative_t right;
+} relative_node_t;
+
+// Random insertions and lookups in an unbalanced binary search tree, with the nodes in a freelist pool.
+f64 benchmark_tree_pointer(u64* found) {
+    byte_t* memory = (byte_t*) malloc(TREE_NODES * sizeof(pointer_node_t));
+    allocator_freelist_t pool = freelist_init(memory, sizeof(pointer_node_t), TREE_NODES);
+    u64 state = 42;
+
+    pointer_node_t* root = 0;
+    for (u32 i = 0; i < TREE_NODES; ++i) {
+        pointer_node_t* node = (pointer_node_t*) freelist_allocate(&pool, sizeof(pointer_node_t)).memory;
+        *node = (pointer_node_t) { .key=benchmark_random(&state), .left=0, .right=0 };
+        pointer_node_t** link = &root;
+        while (*link != 0)
+            link = (node->key < (*link)->key) ? &(*link)->left : &(*link)->right;
+        *link = node;
+    }
+
+    f64 start = benchmark_now();
+    state = 42;
+    for (u32 i = 0; i < TREE_LOOKUPS; ++i) {
+        u32 key = benchmark_random(&state);
+        pointer_node_t* node = root;
+        while (node != 0 && node->key != key)
+            node = (key < node->key) ? node->left : node->right;
+        *found += node != 0;
+    }
+    f64 time = benchmark_now() - start;
+    free(memory);
+    return time;
+}
+
+f64 benchmark_tree_relative(u64* found) {
+    byte_t* memory = (byte_t*) malloc(TREE_NODES * sizeof(relative_node_t));
+    allocator_freelist_t pool = freelist_init(memory, sizeof(relative_node_t), TREE_NODES);
+    u64 state = 42;
+
+    freelist_relative_t root = 0;
+    for (u32 i = 0; i < TREE_NODES; ++i) {
+        freelist_relative_t offset = freelist_allocate_relative(&pool);
+        relative_node_t* node = freelist_pointer(&pool, relative_node_t, offset);
+        *node = (relative_node_t) { .key=benchmark_random(&state), .left=0, .right=0 };
+        freelist_relative_t* link = &root;
+        while (*link != 0) {
+            relative_node_t* parent = freelist_pointer(&pool, relative_node_t, *link);
+            link = (node->key < parent->key) ? &parent->left : &parent->right;
+        }
+        *link = offset;
+    }
+
+    f64 start = benchmark_now();
+    state = 42;
+    for (u32 i = 0; i < TREE_LOOKUPS; ++i) {
+        u32 key = benchmark_random(&state);
+        relative_node_t* node = freelist_pointer(&pool, relative_node_t, root);
+        while (node != 0 && node->key != key)
+            node = freelist_pointer(&pool, relative_node_t, (key < node->key) ? node->left : node->right);
+        *found += node != 0;
+    }
+    f64 time = benchmark_now() - start;
+    free(memory);
+    return time;
+}
+
+void benchmark_relative(void) {
+    printf("---- Binary tree lookups (%d nodes, %d lookups) ----\n", TREE_NODES, TREE_LOOKUPS);
+
+    u64 found_pointer  = 0;
+    u64 found_relative = 0;
+    f64 time_pointer  = benchmark_tree_pointer(&found_pointer);
+    f64 time_relative = benchmark_tree_relative(&found_relative);
+    ASSERT(found_pointer == found_relative);
+    printf("pointers   %2zu B/node %8.3f ms\n", sizeof(pointer_node_t),  time_pointer  * 1000.0);
+    printf("relative   %2zu B/node %8.3f ms\n", sizeof(relative_node_t), time_relative * 1000.0);
+}
+
+
+/* ---- CONCURRENT ARENA ---- */
+#define CONCURRENT_THREADS      4
+#define CONCURRENT_ALLOCATIONS  (1000 * 1000)   // Per thread.
+
+typedef struct {
+    allocator_t      allocator;
+    pthread_mutex_t* lock;        // Only for the stack, which isn't thread-safe.
+    u32              thread;
+    u64              checksum;
+} benchmark_concurrent_worker_t;
+
+// Fills a part of a batch result: many small allocations, each stamped with the thread.
+void* benchmark_concurrent_worker(void* worker_raw) {
+    benchmark_concurrent_worker_t* worker = (benchmark_concurrent_worker_t*) worker_raw;
+    u64 state = 42 + worker->thread;
+    byte_t* previous = 0;
+    for (u32 i = 0; i < CONCURRENT_ALLOCATIONS; ++i) {
+        word_t size = 8 + (word_t) (benchmark_random(&state) % 57);
+        if (worker->lock != 0)
+            pthread_mutex_lock(worker->lock);
+        byte_t* memory = nax_allocate_aligned(worker->allocator, size, 8);
+        if (worker->lock != 0)
+            pthread_mutex_unlock(worker->lock);
+        ASSERT(allocation_succeeded(memory) && ((size_t) memory & 7) == 0);
+        memset(memory, (int) worker->thread, (size_t) size);
+        if (previous != 0)
+            worker->checksum += previous[0] == (byte_t) worker->thread;
+        previous = memory;
+    }
+    return 0;
+}
+
+f64 benchmark_concurrent_run(allocator_t shared, concurrent_chunk_t* chunks, pthread_mutex_t* lock) {
+    benchmark_concurrent_worker_t workers[CONCURRENT_THREADS];
+    pthread_t threads[CONCURRENT_THREADS];
+
+    f64 start = benchmark_now();
+    for (u32 i = 0; i < CONCURRENT_THREADS; ++i) {
+        allocator_t allocator = shared;
+        if (chunks != 0)
+            allocator = (allocator_t) { allocator_concurrent_chunk_proc, &chunks[i] };
+        workers[i] = (benchmark_concurrent_worker_t) { allocator, lock, i, 0 };
+        pthread_create(&threads[i], 0, benchmark_concurrent_worker, &workers[i]);
+    }
+    for (u32 i = 0; i < CONCURRENT_THREADS; ++i) {
+        pthread_join(threads[i], 0);
+        ASSERT(workers[i].checksum == CONCURRENT_ALLOCATIONS - 1);
+    }
+    return benchmark_now() - start;
+}
+
+void benchmark_concurrent(void) {
+    printf("---- Shared arena (%d threads x %d allocations of 8-64 bytes) ----\n", CONCURRENT_THREADS, CONCURRENT_ALLOCATIONS);
+
+    size_t capacity = (size_t) CONCURRENT_THREADS * CONCURRENT_ALLOCATIONS * 96;
+    byte_t* memory = (byte_t*) malloc(capacity);
+
+    allocator_stack_t stack_alloc = allocator_stack_init(memory, (u32) capacity);
+    allocator_t stack = { allocator_stack_proc, &stack_alloc };
+    pthread_mutex_t lock;
+    pthread_mutex_init(&lock, 0);
+    f64 time_locked = benchmark_concurrent_run(stack, 0, &lock);
+    printf("stack + mutex      %8.3f ms\n", time_locked * 1000.0);
+
+    allocator_concurrent_t concurrent_alloc = concurrent_init(memory, capacity);
+    allocator_t concurrent = { allocator_concurrent_proc, &concurrent_alloc };
+    f64 time_atomic = benchmark_concurrent_run(concurrent, 0, 0);
+    printf("fetch-add          %8.3f ms  %6.1f MiB used\n", time_atomic * 1000.0, (f64) nax_query_used(concurrent) / (1024 * 1024));
+
+    nax_free_all(concurrent);
+    concurrent_chunk_t chunks[CONCURRENT_THREADS];
+    for (u32 i = 0; i < CONCURRENT_THREADS; ++i)
+        chunks[i] = concurrent_chunk_init(&concurrent_alloc, 64 * 1024);
+    f64 time_chunks = benchmark_concurrent_run(concurrent, chunks, 0);
+    printf("per-thread chunks  %8.3f ms  %6.1f MiB used\n", time_chunks * 1000.0, (f64) nax_query_used(concurrent) / (1024 * 1024));
+
+    free(memory);
+}
+
+
+/* ---- I/O BUFFER POOL ---- */
+#define IO_FILE_SIZE    (64 * 1024 * 1024)
+#define IO_BUFFER_SIZE  (128 * 1024)
+#define IO_PASSES       4
+
+// Reads the whole file a buffer at a time, taking a fresh buffer for every read like a storage path would.
+f64 benchmark_io_read(int file, allocator_t allocator, u64* checksum) {
+    f64 start = benchmark_now();
+    for (int pass = 0; pass < IO_PASSES; ++pass) {
+        for (off_t offset = 0; offset < IO_FILE_SIZE; offset += IO_BUFFER_SIZE) {
+            byte_t* buffer = nax_allocate_aligned(allocator, IO_BUFFER_SIZE, IOPOOL_ALIGNMENT);
+            ASSERT(allocation_succeeded(buffer) && ((size_t) buffer & (IOPOOL_ALIGNMENT - 1)) == 0);
+            ssize_t read = pread(file, buffer, IO_BUFFER_SIZE, offset);
+            ASSERT(read == IO_BUFFER_SIZE);
+            *checksum += buffer[0] + buffer[IO_BUFFER_SIZE - 1];
+            nax_free(allocator, buffer);
+        }
+    }
+    return benchmark_now() - start;
+}
+
+// The same reads with posix_memalign and free called directly, without the poisoning allocator_malloc
+// does, so the baseline pays for nothing a storage path without a pool wouldn't.
+f64 benchmark_io_read_memalign(int file, u64* checksum) {
+    f64 start = benchmark_now();
+    for (int pass = 0; pass < IO_PASSES; ++pass) {
+        for (off_t offset = 0; offset < IO_FILE_SIZE; offset += IO_BUFFER_SIZE) {
+            byte_t* buffer = 0;
+            ASSERT(posix_memalign((void**) &buffer, IOPOOL_ALIGNMENT, IO_BUFFER_SIZE) == 0);
+            ssize_t read = pread(file, buffer, IO_BUFFER_SIZE, offset);
+            ASSERT(read == IO_BUFFER_SIZE);
+            *checksum += buffer[0] + buffer[IO_BUFFER_SIZE - 1];
+            free(buffer);
+        }
+    }
+    return benchmark_now() - start;
+}
+
+void benchmark_io(void) {
+    printf("---- File reads (%d MiB file, %d KiB reads, %d passes) ----\n", IO_FILE_SIZE / (1024 * 1024), IO_BUFFER_SIZE / 1024, IO_PASSES);
+
+    char path[] = "benchmark_io_XXXXXX";
+    int file = mkstemp(path);
+    ASSERT(file >= 0);
+    byte_t* block = (byte_t*) malloc(IO_BUFFER_SIZE);
+    for (off_t offset = 0; offset < IO_FILE_SIZE; offset += IO_BUFFER_SIZE) {
+        memset(block, (int) (offset / IO_BUFFER_SIZE), IO_BUFFER_SIZE);
+        ASSERT(write(file, block, IO_BUFFER_SIZE) == IO_BUFFER_SIZE);
+    }
+    free(block);
+    fsync(file);
+
+    allocator_iopool_t pool_alloc;
+    ASSERT(iopool_init(&pool_alloc, IO_BUFFER_SIZE, 64));
+    iopool_cache_t cache = iopool_cache_init(&pool_alloc);
+    allocator_t pool = { allocator_iopool_cache_proc, &cache };
+
+    u64 checksum_buffered = 0;
+    f64 time_buffered = benchmark_io_read_memalign(file, &checksum_buffered);
+    printf("page cache, posix_memalign   %8.3f ms  %7.1f MiB/s\n", time_buffered * 1000.0, IO_PASSES * (IO_FILE_SIZE / (1024.0 * 1024.0)) / time_buffered);
+    close(file);
+
+    file = open(path, O_RDONLY | O_DIRECT);
+    if (file < 0) {
+        printf("O_DIRECT is not supported here, reads go through the page cache\n");
+        file = open(path, O_RDONLY);
+    }
+    u64 checksum_malloc = 0;
+    u64 checksum_pool   = 0;
+    f64 time_malloc = benchmark_io_read_memalign(file, &checksum_malloc);
+    printf("direct, posix_memalign       %8.3f ms  %7.1f MiB/s\n", time_malloc * 1000.0, IO_PASSES * (IO_FILE_SIZE / (1024.0 * 1024.0)) / time_malloc);
+    f64 time_pool = benchmark_io_read(file, pool, &checksum_pool);
+    printf("direct, I/O pool             %8.3f ms  %7.1f MiB/s\n", time_pool * 1000.0, IO_PASSES * (IO_FILE_SIZE / (1024.0 * 1024.0)) / time_pool);
+    ASSERT(checksum_buffered == checksum_malloc && checksum_malloc == checksum_pool);
+
+    close(file);
+    unlink(path);
+    iopool_cache_flush(&cache);
+    iopool_destroy(&pool_alloc);
+}
+
+
+/* ---- TABLE AND INTERNER ---- */
+#define TABLE_REQUESTS  200000
+#define TABLE_HEADERS   24
+#define TABLE_NAMES     64
+
+// Every request interns its header names and counts them in a table, then drops both.
+f64 benchmark_table_requests(allocator_t allocator, int arena, u64* checksum) {
+    char names[TABLE_NAMES][16];
+    for (u32 i = 0; i < TABLE_NAMES; ++i)
+        snprintf(names[i], sizeof(names[i]), "X-Header-%u", i);
+    u64 state = 42;
+
+    f64 start = benchmark_now();
+    for (int request = 0; request < TABLE_REQUESTS; ++request) {
+        interner_t interner = interner_init(allocator, arena);
+        table_t    counts   = table_init_type(allocator, u64, u32, arena);
+        for (int header = 0; header < TABLE_HEADERS; ++header) {
+            const char* name = interner_intern_cstring(&interner, names[benchmark_random(&state) % TABLE_NAMES]);
+            u64  key   = (u64) name;
+            u32* count = (u32*) table_find(&counts, &key);
+            u32  next  = (count != 0) ? *count + 1 : 1;
+            table_insert(&counts, &key, &next);
+        }
+        *checksum += interner_count(&interner) + counts.m_count;
+        if (arena) {
+            nax_free_all(allocator);
+            interner_reset(&interner);
+            table_reset(&counts);
+        } else {
+            interner_free(&interner);
+            table_free(&counts);
+        }
+    }
+    return benchmark_now() - start;
+}
+
+void benchmark_table(void) {
+    printf("---- Per-request header tables (%d requests, %d headers) ----\n", TABLE_REQUESTS, TABLE_HEADERS);
+
+    size_t  capacity = 64 * 1024;
+    byte_t* memory   = (byte_t*) malloc(capacity);
+    allocator_stack_t arena_alloc = allocator_stack_init(memory, capacity);
+    allocator_t arena = { allocator_stack_proc, &arena_alloc };
+
+    u64 checksum_malloc = 0;
+    u64 checksum_arena  = 0;
+    f64 time_malloc = benchmark_table_requests(allocator_malloc, 0, &checksum_malloc);
+    f64 time_arena  = benchmark_table_requests(arena, 1, &checksum_arena);
+    ASSERT(checksum_malloc == checksum_arena);
+    printf("malloc, freed one by one     %8.3f ms\n", time_malloc * 1000.0);
+    printf("arena, FREE_ALL and reset    %8.3f ms\n", time_arena  * 1000.0);
+    free(memory);
+}
+
+
+/* ---- CACHE LINES ---- */
+#define COUNTER_THREADS     4
+#define COUNTER_INCREMENTS  (20 * 1000 * 1000)   // Per thread.
+
+void* benchmark_counter_worker(void* counter_raw) {
+    volatile u64* counter = (volatile u64*) counter_raw;
+    for (int i = 0; i < COUNTER_INCREMENTS; ++i)
+        *counter += 1;
+    return 0;
+}
+
+// Every thread increments a counter of its own, allocated one after the other.
+f64 benchmark_counters(allocator_t allocator) {
+    pthread_t threads[COUNTER_THREADS];
+    u64*      counters[COUNTER_THREADS];
+    for (u32 i = 0; i < COUNTER_THREADS; ++i) {
+        counters[i] = (u64*) nax_allocate_type(allocator, u64, 1);
+        ASSERT(allocation_succeeded((byte_t*) counters[i]));
+        *counters[i] = 0;
+    }
+
+    f64 start = benchmark_now();
+    for (u32 i = 0; i < COUNTER_THREADS; ++i)
+        pthread_create(&threads[i], 0, benchmark_counter_worker, counters[i]);
+    for (u32 i = 0; i < COUNTER_THREADS; ++i)
+        pthread_join(threads[i], 0);
+    f64 elapsed = benchmark_now() - start;
+
+    for (u32 i = 0; i < COUNTER_THREADS; ++i)
+        ASSERT(*counters[i] == COUNTER_INCREMENTS);
+    nax_free_all(allocator);
+    return elapsed;
+}
+
+
+#define COLOR_POOLS       64
+#define COLOR_POOL_SIZE   (16 * 1024)
+#define COLOR_BLOCK_SIZE  1000
+#define COLOR_ROUNDS      (200 * 1000)
+
+// Follows a random cycle through the first block of every pool, where each pool's hottest object sits.
+f64 benchmark_color_chase(byte_t* region, int colored, u64* checksum) {
+    allocator_freelist_t pools[COLOR_POOLS];
+    void** first[COLOR_POOLS];
+    u32    order[COLOR_POOLS];
+    for (u32 i = 0; i < COLOR_POOLS; ++i) {
+        byte_t* memory = region + (size_t) i * COLOR_POOL_SIZE;
+        pools[i] = colored ? freelist_init_colored(memory, COLOR_POOL_SIZE, COLOR_BLOCK_SIZE, i)
+                           : freelist_init(memory, COLOR_BLOCK_SIZE, COLOR_POOL_SIZE / COLOR_BLOCK_SIZE);
+        first[i] = (void**) freelist_allocate(&pools[i], COLOR_BLOCK_SIZE).memory;
+        order[i] = i;
+    }
+    u64 state = 42;
+    for (u32 i = COLOR_POOLS - 1; i > 0; --i) {
+        u32 j = benchmark_random(&state) % (i + 1);
+        u32 swap = order[i]; order[i] = order[j]; order[j] = swap;
+    }
+    for (u32 i = 0; i < COLOR_POOLS; ++i)
+        *first[order[i]] = first[order[(i + 1) % COLOR_POOLS]];
+
+    void** node = first[order[0]];
+    f64 start = benchmark_now();
+    for (u32 i = 0; i < COLOR_ROUNDS * COLOR_POOLS; ++i)
+        node = (void**) *node;
+    f64 elapsed = benchmark_now() - start;
+    *checksum += (u64) (node == first[order[0]]);
+    return elapsed;
+}
+
+void benchmark_cache_lines(void) {
+    printf("---- Per-thread counters (%d threads, %d increments each) ----\n", COUNTER_THREADS, COUNTER_INCREMENTS);
+
+    byte_t* memory = (byte_t*) aligned_alloc(4096, COLOR_POOLS * COLOR_POOL_SIZE);
+    allocator_stack_t stack_alloc = allocator_stack_init(memory, 4096);
+    allocator_t stack = { allocator_stack_proc, &stack_alloc };
+    allocator_exclusive_t exclusive_alloc = exclusive_init(stack, CACHE_LINE_SIZE);
+    allocator_t exclusive = { allocator_exclusive_proc, &exclusive_alloc };
+
+    f64 time_packed    = benchmark_counters(stack);
+    f64 time_exclusive = benchmark_counters(exclusive);
+    printf("packed, one line       %8.3f ms\n", time_packed    * 1000.0);
+    printf("exclusive lines        %8.3f ms\n", time_exclusive * 1000.0);
+
+    printf("---- Hot blocks of %d pools (%d KiB each, %d B blocks) ----\n", COLOR_POOLS, COLOR_POOL_SIZE / 1024, COLOR_BLOCK_SIZE);
+    u64 checksum = 0;
+    f64 time_aligned = benchmark_color_chase(memory, 0, &checksum);
+    f64 time_colored = benchmark_color_chase(memory, 1, &checksum);
+    ASSERT(checksum == 2);
+    printf("same offset            %8.3f ns/access\n", time_aligned * 1e9 / ((f64) COLOR_ROUNDS * COLOR_POOLS));
+    printf("colored                %8.3f ns/access\n", time_colored * 1e9 / ((f64) COLOR_ROUNDS * COLOR_POOLS));
+    free(memory);
+}
+
+
+/* ---- TORTURE ---- */
+#define TORTURE_OPERATIONS  200000
+#define TORTURE_SLOTS       1024
+#define TORTURE_WARMUP      (TORTURE_OPERATIONS / 5)   // Operations before the footprint is sampled.
+#define TORTURE_SAMPLE      64                          // Operations between footprint samples.
+#define TORTURE_CHECK       4096                        // Operations between checks of every live block.
+#define TORTURE_FREE_ALL    20000                       // Average operations between FREE_ALL.
+
+// mallinfo2 describes glibc's heap, which a sanitizer replaces with its own.
+#if defined(__SANITIZE_ADDRESS__)
+    #define TORTURE_MALLINFO 0
+#elif defined(__has_feature)
+    #if __has_feature(address_sanitizer)
+        #define TORTURE_MALLINFO 0
+    #endif
+#endif
+#if !defined(TORTURE_MALLINFO) && defined(__GLIBC__)
+    #define TORTURE_MALLINFO 1
+#elif !defined(TORTURE_MALLINFO)
+    #define TORTURE_MALLINFO 0
+#endif
+
+typedef struct {
+    const char* name;
+    allocator_t allocator;
+    word_t      maximum_size;
+    word_t      maximum_alignment;
+    int         lifo;                     // Only the latest allocation can be freed, as in a stack.
+    int         can_resize;
+    int         can_free_all;
+    size_t    (*footprint)(void* data);   // Bytes held, including what is kept free. QUERY_USED if not set,
+                                          // unknown if it returns ALLOCATION_QUERY_UNSUPPORTED.
+    void*       data;
+} torture_config_t;
+
+// The shadow model of one live allocation: its contents are a pattern generated from `seed`.
+typedef struct {
+    byte_t* memory;
+    word_t  size;
+    size_t  usable;
+    u32     seed;
+} torture_block_t;
+
+typedef struct {
+    u64    calls;
+    u64    failures;
+    f64    time;
+    u64    samples;
+    f64    requested;
+    f64    usable;
+    f64    used;
+    f64    footprint;
+    size_t peak_requested;
+    size_t peak_footprint;
+    int    unknown_footprint;
+} torture_stats_t;
+
+// Static, so the shadow model doesn't take part in the malloc footprint it measures.
+static torture_block_t torture_blocks[TORTURE_SLOTS];
+
+
+u8 torture_byte(u32 seed, size_t offset) {
+    return (u8) ((seed + (u32) offset * 0x9E3779B1u) >> 24);
+}
+
+void torture_fill(torture_block_t* block, size_t from) {
+    for (size_t i = from; i < (size_t) block->size; ++i)
+        block->memory[i] = torture_byte(block->seed, i);
+}
+
+void torture_check(const torture_config_t* config, torture_block_t* block, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        ASSERTF(block->memory[i] == torture_byte(block->seed, i), "%s: byte %zu of %p (%zu bytes) was overwritten!",
+                config->name, i, (void*) block->memory, (size_t) block->size);
+    }
+}
+
+
+// Log-uniform, so small sizes are as common as they are in real programs.
+word_t torture_size(u64* state, word_t maximum) {
+    u32 bits = 64 - (u32) __builtin_clzll((u64) maximum);
+    word_t size = 1 + (word_t) (benchmark_random(state) % ((u64) 1 << (benchmark_random(state) % bits)));
+    return (size < maximum) ? size : maximum;
+}
+
+size_t torture_usable(allocator_t allocator, const byte_t* memory, word_t size) {
+    size_t usable = nax_query_usable_size(allocator, memory);
+    return (usable == ALLOCATION_QUERY_UNSUPPORTED || usable < (size_t) size) ? (size_t) size : usable;
+}
+
+
+void torture_release_all(const torture_config_t* config, torture_block_t* blocks, u32* count, size_t* requested, size_t* usable) {
+    if (config->can_free_all) {
+        ASSERT(free_succeeded(nax_free_all(config->allocator)));
+    } else {
+        for (u32 i = *count; i > 0; --i)
+            ASSERT(free_succeeded(nax_free(config->allocator, blocks[i - 1].memory)));
+    }
+    *count     = 0;
+    *requested = 0;
+    *usable    = 0;
+}
+
+
+// Runs random operations against the allocator and the shadow model side by side.
+torture_stats_t torture_run(const torture_config_t* config) {
+    torture_stats_t  stats  = { 0 };
+    torture_block_t* blocks = torture_blocks;
+    allocator_t allocator = config->allocator;
+    u32    count     = 0;
+    size_t requested = 0;
+    size_t usable    = 0;
+    u64    state     = 42;
+
+    size_t alignment = nax_query_alignment(allocator);
+    if (alignment == ALLOCATION_QUERY_UNSUPPORTED)
+        alignment = 1;
+
+    for (u32 operation = 0; operation < TORTURE_OPERATIONS; ++operation) {
+        u32 choice = benchmark_random(&state) % 100;
+
+        if (benchmark_random(&state) % TORTURE_FREE_ALL == 0) {
+            for (u32 i = 0; i < count; ++i)
+                torture_check(config, &blocks[i], (size_t) blocks[i].size);
+            f64 start = benchmark_now();
+            torture_release_all(config, blocks, &count, &requested, &usable);
+            stats.time  += benchmark_now() - start;
+            stats.calls += 1;
+        } else if (choice < 45 && count < TORTURE_SLOTS) {
+            torture_block_t block = { .size=torture_size(&state, config->maximum_size), .seed=benchmark_random(&state) };
+            int    aligned = benchmark_random(&state) & 1;
+            size_t wanted  = aligned ? (size_t) 1 << (benchmark_random(&state) % (64 - __builtin_clzll((u64) config->maximum_alignment))) : alignment;
+
+            f64 start = benchmark_now();
+            block.memory = aligned ? nax_allocate_aligned(allocator, block.size, (word_t) wanted) : nax_allocate(allocator, block.size);
+            stats.time  += benchmark_now() - start;
+            stats.calls += 1;
+            if (!allocation_succeeded(block.memory)) {
+                stats.failures += 1;
+                continue;
+            }
+            ASSERTF(((size_t) block.memory & (wanted - 1)) == 0, "%s: %p isn't aligned to %zu!", config->name, (void*) block.memory, wanted);
+            block.usable = torture_usable(allocator, block.memory, block.size);
+            torture_fill(&block, 0);
+            blocks[count++] = block;
+            requested += (size_t) block.size;
+            usable    += block.usable;
+        } else if (choice < 60) {
+            if (count == 0 || !config->can_resize)
+                continue;
+            u32 index = benchmark_random(&state) % count;
+            torture_block_t block = blocks[index];
+            word_t new_size = torture_size(&state, config->maximum_size);
+            torture_check(config, &block, (size_t) block.size);
+
+            f64 start = benchmark_now();
+            byte_t* memory = nax_resize(allocator, block.memory, new_size, block.size);
+            stats.time  += benchmark_now() - start;
+            stats.calls += 1;
+            if (!allocation_succeeded(memory)) {
+                stats.failures += 1;
+                torture_check(config, &block, (size_t) block.size);
+                continue;
+            }
+
+            word_t kept = (new_size < block.size) ? new_size : block.size;
+            requested += (size_t) new_size - (size_t) block.size;
+            usable    -= block.usable;
+            block.memory = memory;
+            block.size   = new_size;
+            block.usable = torture_usable(allocator, memory, new_size);
+            usable      += block.usable;
+            torture_check(config, &block, (size_t) kept);
+            torture_fill(&block, (size_t) kept);
+
+            // A moved block is now the latest allocation of a stack.
+            if (config->lifo && memory != blocks[index].memory) {
+                memmove(&blocks[index], &blocks[index + 1], (count - index - 1) * sizeof(torture_block_t));
+                index = count - 1;
+            }
+            blocks[index] = block;
+        } else if (count > 0) {
+            u32 index = config->lifo ? count - 1 : benchmark_random(&state) % count;
+            torture_check(config, &blocks[index], (size_t) blocks[index].size);
+
+            f64 start = benchmark_now();
+            size_t status = nax_free(allocator, blocks[index].memory);
+            stats.time  += benchmark_now() - start;
+            stats.calls += 1;
+            ASSERTF(free_succeeded(status), "%s: FREE failed with %zu!", config->name, status);
+            requested -= (size_t) blocks[index].size;
+            usable    -= blocks[index].usable;
+            blocks[index] = blocks[--count];
+        }
+
+        if (operation % TORTURE_CHECK == 0) {
+            for (u32 i = 0; i < count; ++i)
+                torture_check(config, &blocks[i], (size_t) blocks[i].size);
+        }
+
+        if (operation >= TORTURE_WARMUP && operation % TORTURE_SAMPLE == 0) {
+            size_t used = nax_query_used(allocator);
+            if (used == ALLOCATION_QUERY_UNSUPPORTED)
+                used = usable;
+            size_t footprint = (config->footprint != 0) ? config->footprint(config->data) : used;
+            if (footprint == ALLOCATION_QUERY_UNSUPPORTED) {
+                stats.unknown_footprint = 1;
+                footprint = 0;
+            }
+            stats.samples   += 1;
+            stats.requested += (f64) requested;
+            stats.usable    += (f64) usable;
+            stats.used      += (f64) used;
+            stats.footprint += (f64) footprint;
+            if (requested > stats.peak_requested)
+                stats.peak_requested = requested;
+            if (footprint > stats.peak_footprint)
+                stats.peak_footprint = footprint;
+        }
+    }
+
+    for (u32 i = 0; i < count; ++i)
+        torture_check(config, &blocks[i], (size_t) blocks[i].size);
+    torture_release_all(config, blocks, &count, &requested, &usable);
+    return stats;
+}
+
+
+void torture_report(const torture_config_t* config) {
+    torture_stats_t stats = torture_run(config);
+    f64 live = (stats.requested > 0) ? stats.requested : 1;
+    printf("%-26s %7.1f %6.2f%% %9.1f%% %8.1f%%", config->name,
+           stats.time * 1e9 / (f64) stats.calls,
+           100.0 * (f64) stats.failures / (f64) stats.calls,
+           100.0 * (stats.usable    - stats.requested) / live,
+           100.0 * (stats.used      - stats.usable)    / live);
+    if (stats.unknown_footprint) {
+        printf(" %10s %8s\n", "n/a", "n/a");
+    } else {
+        printf(" %9.1f%% %8.2f\n",
+               100.0 * (stats.footprint - stats.used) / live,
+               (f64) stats.peak_footprint / (f64) (stats.peak_requested ? stats.peak_requested : 1));
+    }
+}
+
+
+// malloc's footprint is the chunks it has in use since the run started, with their headers. That
+// includes freed chunks it caches per thread, which it doesn't count as free; the ones cached
+// before the run are part of the baseline, so reusing them can make "held" slightly negative.
+size_t torture_malloc_footprint(void* baseline_raw) {
+#if TORTURE_MALLINFO
+    struct mallinfo2 info = mallinfo2();
+    size_t in_use = info.uordblks + info.hblkhd;
+    size_t baseline = *(size_t*) baseline_raw;
+    return (in_use > baseline) ? in_use - baseline : 0;
+#else
+    (void) baseline_raw;
+    return ALLOCATION_QUERY_UNSUPPORTED;
+#endif
+}
+
+size_t torture_malloc_baseline(void) {
+#if TORTURE_MALLINFO
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// Trims what earlier benchmarks left behind and runs the malloc configuration once untimed, so
+// every malloc-backed row starts from the same warm heap whatever ran before it.
+void torture_malloc_warmup(void) {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    size_t baseline = torture_malloc_baseline();
+    torture_config_t config = { "malloc", allocator_malloc, 4096, 256, 0, 1, 0, torture_malloc_footprint, &baseline };
+    torture_run(&config);
+}
+
+// A freelist holds every block it has ever handed out, free or not.
+size_t torture_freelist_footprint(void* freelist_raw) {
+    allocator_freelist_t* freelist = (allocator_freelist_t*) freelist_raw;
+    return (size_t) freelist->m_untouched * freelist->m_block_size;
+}
+
+// Live stacks and the cached ones that haven't been decommitted yet.
+size_t torture_fiber_footprint(void* fiber_raw) {
+    allocator_fiber_t* fiber = (allocator_fiber_t*) fiber_raw;
+    return (size_t) (fiber->m_live + fiber->m_cached - fiber->m_cold) * fiber->m_stack_size;
+}
+
+
+void benchmark_torture(void) {
+    printf("---- Torture (%d random operations, up to %d live blocks) ----\n", TORTURE_OPERATIONS, TORTURE_SLOTS);
+    printf("rounding: usable beyond requested, padding: used beyond usable, held: footprint beyond used (all per live byte)\n");
+    if (!TORTURE_MALLINFO)
+        printf("malloc footprints are n/a: mallinfo2 doesn't describe this build's malloc\n");
+    printf("%-26s %7s %7s %10s %9s %10s %8s\n", "", "ns/op", "failed", "rounding", "padding", "held", "peak/live");
+
+    size_t arena_capacity = 64 * 1024 * 1024;
+    byte_t* arena_memory  = (byte_t*) aligned_alloc(4096, arena_capacity);
+    byte_t* pool_memory   = (byte_t*) aligned_alloc(4096, 4096 * 256);
+    size_t  malloc_baseline = 0;
+    torture_malloc_warmup();
+
+    {
+        malloc_baseline = torture_malloc_baseline();
+        torture_config_t config = { "malloc", allocator_malloc, 4096, 256, 0, 1, 0, torture_malloc_footprint, &malloc_baseline };
+        torture_report(&config);
+    }
+    {
+        allocator_large_t large_alloc = large_init();
+        torture_config_t config = { "large", { allocator_large_proc, &large_alloc }, 4096, 256, 0, 1, 0, 0, 0 };
+        torture_report(&config);
+        large_destroy(&large_alloc);
+    }
+    {
+        allocator_stack_t stack_alloc = allocator_stack_init(arena_memory, 16 * 1024 * 1024);
+        torture_config_t config = { "stack", { allocator_stack_proc, &stack_alloc }, 4096, 256, 1, 1, 1, 0, 0 };
+        torture_report(&config);
+    }
+    {
+        char path[] = "benchmark_torture_XXXXXX";
+        int file = mkstemp(path);
+        ASSERT(file >= 0);
+        close(file);
+        unlink(path);
+        allocator_persistent_t persistent_alloc;
+        ASSERT(persistent_open(&persistent_alloc, path, 16 * 1024 * 1024) == PERSISTENT_STATUS_CREATED);
+        torture_config_t config = { "persistent", { allocator_persistent_proc, &persistent_alloc }, 4096, 256, 1, 1, 1, 0, 0 };
+        torture_report(&config);
+        persistent_close(&persistent_alloc);
+        unlink(path);
+    }
+    {
+        allocator_freelist_t freelist_alloc = freelist_init(pool_memory, 256, 4096);
+        torture_config_t config = { "freelist", { allocator_freelist_proc, &freelist_alloc }, 256, 256, 0, 1, 1, torture_freelist_footprint, &freelist_alloc };
+        torture_report(&config);
+    }
+    {
+        allocator_concurrent_t concurrent_alloc = concurrent_init(arena_memory, arena_capacity);
+        torture_config_t config = { "concurrent", { allocator_concurrent_proc, &concurrent_alloc }, 4096, 256, 0, 1, 1, 0, 0 };
+        torture_report(&config);
+    }
+    {
+        allocator_concurrent_t concurrent_alloc = concurrent_init(arena_memory, arena_capacity);
+        concurrent_chunk_t chunk = concurrent_chunk_init(&concurrent_alloc, 64 * 1024);
+        torture_config_t config = { "concurrent chunk", { allocator_concurrent_chunk_proc, &chunk }, 4096, 256, 0, 1, 1, 0, 0 };
+        torture_report(&config);
+    }
+    {
+        allocator_fiber_t fiber_alloc;
+        ASSERT(fiber_init(&fiber_alloc, 16 * 1024, TORTURE_SLOTS, 1024 * 1024));
+        torture_config_t config = { "fiber", { allocator_fiber_proc, &fiber_alloc }, 16 * 1024, 4096, 0, 0, 1, torture_fiber_footprint, &fiber_alloc };
+        torture_report(&config);
+        fiber_destroy(&fiber_alloc);
+    }
+    {
+        allocator_iopool_t iopool_alloc;
+        ASSERT(iopool_init(&iopool_alloc, 4096, TORTURE_SLOTS));
+        torture_config_t config = { "I/O pool", { allocator_iopool_proc, &iopool_alloc }, 4096, 4096, 0, 0, 1, 0, 0 };
+        torture_report(&config);
+        iopool_destroy(&iopool_alloc);
+    }
+    {
+        allocator_freelist_t freelist_alloc = freelist_init(pool_memory, 256, 256);
+        allocator_large_t    large_alloc    = large_init();
+        allocator_fallback_t fallback_alloc = { { allocator_freelist_proc, &freelist_alloc }, { allocator_large_proc, &large_alloc } };
+        torture_config_t config = { "fallback(freelist, large)", { allocator_fallback_proc, &fallback_alloc }, 256, 256, 0, 1, 0, 0, 0 };
+        torture_report(&config);
+        large_destroy(&large_alloc);
+    }
+    {
+        allocator_freelist_t   freelist_alloc   = freelist_init(pool_memory, 256, 4096);
+        allocator_large_t      large_alloc      = large_init();
+        allocator_segregator_t segregator_alloc = { { allocator_freelist_proc, &freelist_alloc }, { allocator_large_proc, &large_alloc }, 256, 0 };
+        torture_config_t config = { "segregator(freelist, large)", { allocator_segregator_proc, &segregator_alloc }, 4096, 256, 0, 1, 0, 0, 0 };
+        torture_report(&config);
+        large_destroy(&large_alloc);
+    }
+    {
+        allocator_exclusive_t exclusive_alloc = exclusive_init(allocator_malloc, CACHE_LINE_SIZE);
+        malloc_baseline = torture_malloc_baseline();
+        torture_config_t config = { "exclusive(malloc)", { allocator_exclusive_proc, &exclusive_alloc }, 4096, 256, 0, 1, 0, torture_malloc_footprint, &malloc_baseline };
+        torture_report(&config);
+    }
+    {
+        allocator_stack_t     stack_alloc     = allocator_stack_init(arena_memory, 16 * 1024 * 1024);
+        allocator_exclusive_t exclusive_alloc = exclusive_init((allocator_t) { allocator_stack_proc, &stack_alloc }, CACHE_LINE_SIZE);
+        torture_config_t config = { "exclusive(stack)", { allocator_exclusive_proc, &exclusive_alloc }, 4096, 256, 1, 1, 1, 0, 0 };
+        torture_report(&config);
+    }
+    {
+        allocator_profiler_t* profiler_alloc = (allocator_profiler_t*) malloc(sizeof(allocator_profiler_t));
+        profiler_init(profiler_alloc, allocator_malloc, 64 * 1024);
+        malloc_baseline = torture_malloc_baseline();
+        torture_config_t config = { "profiler(malloc)", { allocator_profiler_proc, profiler_alloc }, 4096, 256, 0, 1, 0, torture_malloc_footprint, &malloc_baseline };
+        torture_report(&config);
+        free(profiler_alloc);
+    }
+    {
+        allocator_epoch_t* epoch_alloc = (allocator_epoch_t*) aligned_alloc(64, sizeof(allocator_epoch_t));
+        epoch_init(epoch_alloc, allocator_malloc);
+        epoch_thread_t* thread = epoch_register(epoch_alloc);
+        malloc_baseline = torture_malloc_baseline();
+        torture_config_t config = { "epoch(malloc)", { allocator_epoch_proc, epoch_alloc }, 4096, 256, 0, 0, 0, torture_malloc_footprint, &malloc_baseline };
+        torture_report(&config);
+        // Waits for every deferred FREE to reach malloc before the records go away.
+        epoch_unregister(thread);
+        ASSERT(epoch_collect(thread) == 0);
+        free(epoch_alloc);
+    }
+
+    free(pool_memory);
+    free(arena_memory);
+}
+
+
+int main(__attribute__((unused)) int argc, __attribute__((unused)) const char* argv[]) {
+    benchmark_array();
+    benchmark_large();
+    benchmark_profiler();
+    benchmark_segregator();
+    benchmark_scavenger();
+    benchmark_fiber();
+    benchmark_relative();
+    benchmark_concurrent();
+    benchmark_io();
+    benchmark_table();
+    benchmark_cache_lines();
+    benchmark_torture();
+    return 0;
+}
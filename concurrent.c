@@ -0,0 +1,227 @@
+/* A bump allocator that many threads can allocate from at once without locks.
+ *
+ * An allocation is a single atomic fetch-add on `m_pointer`, so it never waits for another
+ * thread. Every size is rounded up to CONCURRENT_MINIMUM_ALIGNMENT, which keeps the pointer
+ * aligned to it; a larger alignment reserves `alignment - CONCURRENT_MINIMUM_ALIGNMENT` extra
+ * bytes and aligns inside them. When the pointer passes the capacity the allocation fails,
+ * and so does every later one.
+ *
+ * To not have every thread hit the same cache line, a worker can take a `concurrent_chunk_t`
+ * which reserves `chunk_size` bytes at a time and bumps inside them without atomics. It is
+ * used through `allocator_concurrent_chunk_proc`.
+ *
+ * FREE does nothing, memory is only reclaimed with FREE_ALL, which must not run while any
+ * thread allocates. Chunks notice it through `m_generation` and drop what they reserved.
+ */
+#define CONCURRENT_MINIMUM_ALIGNMENT 16
+
+
+typedef struct {
+    byte_t* m_memory;
+    size_t  m_capacity;
+    size_t  m_pointer;       // May go past the capacity, after which every allocation fails.
+    u32     m_generation;    // Incremented on every FREE_ALL.
+} allocator_concurrent_t;
+
+typedef struct {
+    allocator_concurrent_t* arena;
+    size_t  chunk_size;
+    byte_t* m_cursor;
+    byte_t* m_end;
+    u32     m_generation;
+} concurrent_chunk_t;
+
+
+allocator_concurrent_t concurrent_init(byte_t* memory, size_t capacity) {
+    byte_t* aligned = (byte_t*) align_address((size_t) memory, CONCURRENT_MINIMUM_ALIGNMENT);
+    size_t  lost    = (size_t) (aligned - memory);
+    return (allocator_concurrent_t) {
+            .m_memory     = aligned,
+            .m_capacity   = (capacity > lost) ? (capacity - lost) & ~(size_t) (CONCURRENT_MINIMUM_ALIGNMENT - 1) : 0,
+            .m_pointer    = 0,
+            .m_generation = 0,
+    };
+}
+
+
+// Reserves `size` bytes aligned to `alignment` with one fetch-add.
+byte_t* concurrent_reserve(allocator_concurrent_t* allocator, size_t size, size_t alignment) {
+    size_t padding  = (alignment > CONCURRENT_MINIMUM_ALIGNMENT) ? alignment - CONCURRENT_MINIMUM_ALIGNMENT : 0;
+    size_t reserved = align_address(size, CONCURRENT_MINIMUM_ALIGNMENT) + padding;
+
+    size_t offset = __atomic_fetch_add(&allocator->m_pointer, reserved, __ATOMIC_RELAXED);
+    if (offset + reserved > allocator->m_capacity)
+        return 0;
+    return (byte_t*) align_address((size_t) (allocator->m_memory + offset), alignment);
+}
+
+
+allocation_result_t concurrent_allocate_aligned(allocator_concurrent_t* allocator, word_t size, word_t alignment) {
+    byte_t* memory = concurrent_reserve(allocator, (size_t) size, (size_t) alignment);
+    if (memory == 0) {
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+    return make_allocation_result(memory);
+}
+
+
+int concurrent_owns(allocator_concurrent_t* allocator, const byte_t* memory) {
+    size_t pointer = __atomic_load_n(&allocator->m_pointer, __ATOMIC_RELAXED);
+    size_t used    = (pointer < allocator->m_capacity) ? pointer : allocator->m_capacity;
+    return allocator->m_memory <= memory && memory < allocator->m_memory + used;
+}
+
+
+// Growing always moves, as another thread may have allocated right after the memory.
+allocation_result_t concurrent_resize(allocator_concurrent_t* allocator, byte_t* memory, word_t old_size, word_t new_size) {
+    if (memory == 0) {
+        return concurrent_allocate_aligned(allocator, new_size, CONCURRENT_MINIMUM_ALIGNMENT);
+    }
+    if (new_size <= old_size) {
+        return make_allocation_result(memory);
+    }
+
+    allocation_result_t result = concurrent_allocate_aligned(allocator, new_size, (word_t) address_alignment((size_t) memory, 64));
+    if (allocation_succeeded(result.memory)) {
+        memcpy(result.memory, memory, (size_t) old_size);
+    }
+    return result;
+}
+
+
+allocation_result_t concurrent_free(allocator_concurrent_t* allocator, byte_t* memory) {
+    if (memory != 0 && !concurrent_owns(allocator, memory)) {
+        return make_free_status(FREE_STATUS_CALLED_ON_NON_OWNED_MEMORY);
+    }
+    return make_free_status(FREE_STATUS_SUCCEEDED);
+}
+
+
+// Only safe when no thread is allocating.
+allocation_result_t concurrent_free_all(allocator_concurrent_t* allocator) {
+    __atomic_store_n(&allocator->m_pointer, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocator->m_generation, 1, __ATOMIC_RELEASE);
+    return make_free_status(FREE_STATUS_SUCCEEDED);
+}
+
+
+size_t concurrent_used(allocator_concurrent_t* allocator) {
+    size_t pointer = __atomic_load_n(&allocator->m_pointer, __ATOMIC_RELAXED);
+    return (pointer < allocator->m_capacity) ? pointer : allocator->m_capacity;
+}
+
+
+allocation_result_t allocator_concurrent_proc(void* allocator_raw, allocation_arguments_t arguments) {
+    allocator_concurrent_t* allocator = (allocator_concurrent_t*) allocator_raw;
+    switch (arguments.mode) {
+        case ALLOCATE:          return concurrent_allocate_aligned(allocator, arguments.allocate.size, CONCURRENT_MINIMUM_ALIGNMENT);
+        case ALLOCATE_ALIGNED:  return concurrent_allocate_aligned(allocator, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
+        case RESIZE:            return concurrent_resize(allocator, arguments.resize.memory, arguments.resize.old_size, arguments.resize.new_size);
+        case FREE:              return concurrent_free(allocator, arguments.free.memory);
+        case FREE_ALL:          return concurrent_free_all(allocator);
+        case QUERY_USED:        return make_query_result(concurrent_used(allocator));
+        case QUERY_OWNS:        return make_query_result((size_t) concurrent_owns(allocator, arguments.owns.memory));
+        case QUERY_CAPACITY:    return make_query_result(allocator->m_capacity);
+        case QUERY_ALIGNMENT:
+        case QUERY_GOOD_SIZE:   return make_query_result(CONCURRENT_MINIMUM_ALIGNMENT);
+        case QUERY_ALLOCATION_SIZE:
+            return make_query_result(align_address((size_t) arguments.allocate_aligned.size, CONCURRENT_MINIMUM_ALIGNMENT));
+
+        // @NOTE: Unsupported, it would race with every other thread.
+        case ALLOCATE_ALL:
+            return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
+
+        // @NOTE: Unsupported, sizes aren't stored.
+        case QUERY_USABLE_SIZE:
+            return make_query_result(ALLOCATION_QUERY_UNSUPPORTED);
+    }
+}
+
+
+
+/* ---- PER-THREAD CHUNKS ---- */
+concurrent_chunk_t concurrent_chunk_init(allocator_concurrent_t* arena, size_t chunk_size) {
+    return (concurrent_chunk_t) {
+            .arena        = arena,
+            .chunk_size   = align_address(chunk_size, CONCURRENT_MINIMUM_ALIGNMENT),
+            .m_cursor     = 0,
+            .m_end        = 0,
+            .m_generation = __atomic_load_n(&arena->m_generation, __ATOMIC_ACQUIRE),
+    };
+}
+
+
+allocation_result_t concurrent_chunk_allocate_aligned(concurrent_chunk_t* chunk, word_t size, word_t alignment) {
+    u32 generation = __atomic_load_n(&chunk->arena->m_generation, __ATOMIC_ACQUIRE);
+    if (generation != chunk->m_generation) {
+        chunk->m_cursor     = 0;
+        chunk->m_end        = 0;
+        chunk->m_generation = generation;
+    }
+
+    byte_t* memory = (byte_t*) align_address((size_t) chunk->m_cursor, (size_t) alignment);
+    if (chunk->m_cursor != 0 && memory + size <= chunk->m_end) {
+        chunk->m_cursor = memory + size;
+        return make_allocation_result(memory);
+    }
+
+    // Anything larger than half a chunk goes to the arena directly, to not waste the rest of the chunk.
+    if ((size_t) size + (size_t) alignment > chunk->chunk_size / 2) {
+        return concurrent_allocate_aligned(chunk->arena, size, alignment);
+    }
+
+    byte_t* reserved = concurrent_reserve(chunk->arena, chunk->chunk_size, CONCURRENT_MINIMUM_ALIGNMENT);
+    if (reserved == 0) {
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+    chunk->m_end    = reserved + chunk->chunk_size;
+    memory          = (byte_t*) align_address((size_t) reserved, (size_t) alignment);
+    chunk->m_cursor = memory + size;
+    return make_allocation_result(memory);
+}
+
+
+// The latest allocation of the chunk can grow in place.
+allocation_result_t concurrent_chunk_resize(concurrent_chunk_t* chunk, byte_t* memory, word_t old_size, word_t new_size) {
+    if (memory == 0) {
+        return concurrent_chunk_allocate_aligned(chunk, new_size, CONCURRENT_MINIMUM_ALIGNMENT);
+    }
+    if (new_size <= old_size) {
+        return make_allocation_result(memory);
+    }
+    if (memory + old_size == chunk->m_cursor && memory + new_size <= chunk->m_end) {
+        chunk->m_cursor = memory + new_size;
+        return make_allocation_result(memory);
+    }
+
+    allocation_result_t result = concurrent_chunk_allocate_aligned(chunk, new_size, (word_t) address_alignment((size_t) memory, 64));
+    if (allocation_succeeded(result.memory)) {
+        memcpy(result.memory, memory, (size_t) old_size);
+    }
+    return result;
+}
+
+
+allocation_result_t allocator_concurrent_chunk_proc(void* allocator_raw, allocation_arguments_t arguments) {
+    concurrent_chunk_t* chunk = (concurrent_chunk_t*) allocator_raw;
+    switch (arguments.mode) {
+        case ALLOCATE:          return concurrent_chunk_allocate_aligned(chunk, arguments.allocate.size, CONCURRENT_MINIMUM_ALIGNMENT);
+        case ALLOCATE_ALIGNED:  return concurrent_chunk_allocate_aligned(chunk, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
+        case RESIZE:            return concurrent_chunk_resize(chunk, arguments.resize.memory, arguments.resize.old_size, arguments.resize.new_size);
+
+        case FREE:
+        case FREE_ALL:
+        case ALLOCATE_ALL:
+        case QUERY_USED:
+        case QUERY_OWNS:
+        case QUERY_CAPACITY:
+        case QUERY_ALIGNMENT:
+        case QUERY_GOOD_SIZE:
+        case QUERY_USABLE_SIZE:
+            return allocator_concurrent_proc(chunk->arena, arguments);
+
+        // The next allocation of the chunk starts right after, unlike in the arena.
+        case QUERY_ALLOCATION_SIZE:
+            return make_query_result((size_t) arguments.allocate_aligned.size);
+    }
+}
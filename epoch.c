@@ -0,0 +1,318 @@
+/* Defers FREE until no reader can still hold the memory (epoch-based reclamation).
+ *
+ * Every thread that touches the shared data registers a record and wraps its reads in
+ * `epoch_enter`/`epoch_exit`. A FREE through the allocator doesn't reach the child; it's
+ * put in the calling thread's limbo list for the current global epoch. The global epoch
+ * only advances once every thread inside a critical section has seen it, so memory retired
+ * in epoch `e` is unreachable once the epoch is `e + 2`, and the whole batch is then handed
+ * back to the child at once.
+ *
+ * The child must be safe to call from every registered thread, since each thread releases
+ * its own batches.
+ */
+#include <sched.h>
+
+#define EPOCH_MAX_THREADS        64
+#define EPOCH_BATCH_CAPACITY     126
+#define EPOCH_ADVANCE_INTERVAL   64     // Try to advance the epoch every this many frees.
+#define EPOCH_MAX_PER_THREAD     8      // Epoch allocators one thread can be registered with at once.
+
+
+typedef struct epoch_batch_t {
+    struct epoch_batch_t* next;
+    u32     count;
+    byte_t* memory[EPOCH_BATCH_CAPACITY];
+} epoch_batch_t;
+
+typedef struct {
+    u64            epoch;
+    epoch_batch_t* batches;
+} epoch_limbo_t;
+
+typedef struct allocator_epoch_t allocator_epoch_t;
+
+// Kept on its own cache lines, since the owning thread writes `m_state` on every enter/exit.
+typedef struct __attribute__((aligned(64))) {
+    u64                m_state;      // (local epoch << 1) | is_active, read by other threads.
+    u32                m_in_use;
+    u32                m_frees;      // Frees since the last attempt to advance.
+    allocator_epoch_t* m_owner;
+    epoch_limbo_t      m_limbo[3];   // Indexed by epoch % 3.
+    epoch_batch_t*     m_spare;      // An empty batch kept around to not allocate on every epoch.
+} epoch_thread_t;
+
+struct allocator_epoch_t {
+    allocator_t    child;
+    u64            m_epoch;
+    u32            m_thread_count;   // High water mark of used records.
+    epoch_thread_t m_threads[EPOCH_MAX_THREADS];
+};
+
+
+typedef struct {
+    allocator_epoch_t* allocator;
+    epoch_thread_t*    thread;
+} epoch_registration_t;
+
+// The records used by FREE through `allocator_epoch_proc` on this thread, one per allocator.
+static __thread epoch_registration_t epoch_registrations[EPOCH_MAX_PER_THREAD];
+
+
+epoch_thread_t* epoch_current_thread(allocator_epoch_t* allocator) {
+    for (u32 i = 0; i < EPOCH_MAX_PER_THREAD; ++i) {
+        if (epoch_registrations[i].allocator == allocator)
+            return epoch_registrations[i].thread;
+    }
+    return 0;
+}
+
+
+void epoch_init(allocator_epoch_t* allocator, allocator_t child) {
+    memset(allocator, 0, sizeof(*allocator));
+    allocator->child   = child;
+    allocator->m_epoch = 2;   // So that `epoch - 2` never wraps.
+}
+
+
+epoch_thread_t* epoch_register(allocator_epoch_t* allocator) {
+    ASSERTF(epoch_current_thread(allocator) == 0, "Thread is already registered with the allocator!");
+    epoch_registration_t* registration = 0;
+    for (u32 i = 0; i < EPOCH_MAX_PER_THREAD && registration == 0; ++i) {
+        if (epoch_registrations[i].allocator == 0)
+            registration = &epoch_registrations[i];
+    }
+    ASSERTF(registration != 0, "Thread is registered with more than %d epoch allocators!", EPOCH_MAX_PER_THREAD);
+
+    for (u32 i = 0; i < EPOCH_MAX_THREADS; ++i) {
+        epoch_thread_t* thread = &allocator->m_threads[i];
+        u32 expected = 0;
+        if (__atomic_compare_exchange_n(&thread->m_in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            thread->m_owner = allocator;
+            __atomic_store_n(&thread->m_state, 0, __ATOMIC_RELEASE);
+
+            u32 count = __atomic_load_n(&allocator->m_thread_count, __ATOMIC_RELAXED);
+            while (count < i + 1 && !__atomic_compare_exchange_n(&allocator->m_thread_count, &count, i + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            }
+
+            registration->allocator = allocator;
+            registration->thread    = thread;
+            return thread;
+        }
+    }
+    ASSERTF(0, "More than %d threads registered!", EPOCH_MAX_THREADS);
+    return 0;
+}
+
+
+void epoch_enter(epoch_thread_t* thread) {
+    allocator_epoch_t* allocator = thread->m_owner;
+    u64 epoch = __atomic_load_n(&allocator->m_epoch, __ATOMIC_ACQUIRE);
+    for (;;) {
+        __atomic_store_n(&thread->m_state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+        u64 current = __atomic_load_n(&allocator->m_epoch, __ATOMIC_SEQ_CST);
+        if (current == epoch)
+            break;
+        epoch = current;
+    }
+}
+
+void epoch_exit(epoch_thread_t* thread) {
+    __atomic_store_n(&thread->m_state, 0, __ATOMIC_RELEASE);
+}
+
+
+// Advances the global epoch if every thread in a critical section has seen the current one.
+int epoch_try_advance(allocator_epoch_t* allocator) {
+    u64 epoch = __atomic_load_n(&allocator->m_epoch, __ATOMIC_SEQ_CST);
+    u32 count = __atomic_load_n(&allocator->m_thread_count, __ATOMIC_ACQUIRE);
+    for (u32 i = 0; i < count; ++i) {
+        u64 state = __atomic_load_n(&allocator->m_threads[i].m_state, __ATOMIC_SEQ_CST);
+        if ((state & 1) && (state >> 1) != epoch)
+            return 0;
+    }
+    return __atomic_compare_exchange_n(&allocator->m_epoch, &epoch, epoch + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+
+// The whole list goes back in one pass without touching shared state. The child still gets one FREE
+// per pointer, since the allocator interface has no FREE of many pointers to hand a batch to.
+void epoch_release_limbo(epoch_thread_t* thread, epoch_limbo_t* limbo) {
+    allocator_t child = thread->m_owner->child;
+    epoch_batch_t* batch = limbo->batches;
+    while (batch != 0) {
+        for (u32 i = 0; i < batch->count; ++i) {
+            nax_free(child, batch->memory[i]);
+        }
+        epoch_batch_t* next = batch->next;
+        if (thread->m_spare == 0) {
+            batch->count = 0;
+            batch->next  = 0;
+            thread->m_spare = batch;
+        } else {
+            nax_free(allocator_malloc, (byte_t*) batch);
+        }
+        batch = next;
+    }
+    limbo->batches = 0;
+}
+
+// Releases every limbo list that no reader can reach anymore. Returns how many are left pending.
+u32 epoch_collect(epoch_thread_t* thread) {
+    u64 epoch   = __atomic_load_n(&thread->m_owner->m_epoch, __ATOMIC_ACQUIRE);
+    u32 pending = 0;
+    for (u32 i = 0; i < 3; ++i) {
+        epoch_limbo_t* limbo = &thread->m_limbo[i];
+        if (limbo->batches == 0)
+            continue;
+        if (limbo->epoch + 2 <= epoch) {
+            epoch_release_limbo(thread, limbo);
+        } else {
+            for (epoch_batch_t* batch = limbo->batches; batch != 0; batch = batch->next)
+                pending += batch->count;
+        }
+    }
+    return pending;
+}
+
+
+// For when there's no batch to put `memory` in. Releasing what has expired may leave a batch to
+// reuse; otherwise waits until no reader can hold `memory` and frees it through the child right away.
+allocation_result_t epoch_retire_unbatched(epoch_thread_t* thread, byte_t* memory, u64 epoch) {
+    epoch_collect(thread);
+    if (thread->m_spare != 0) {
+        epoch_limbo_t* limbo = &thread->m_limbo[epoch % 3];
+        epoch_batch_t* fresh = thread->m_spare;
+        thread->m_spare = 0;
+        fresh->count = 0;
+        fresh->next  = limbo->batches;
+        limbo->batches = fresh;
+        fresh->memory[fresh->count++] = memory;
+        return make_free_status(FREE_STATUS_SUCCEEDED);
+    }
+
+    // Inside a critical section the thread holds the epoch back itself, so it could never pass.
+    ASSERTF((__atomic_load_n(&thread->m_state, __ATOMIC_RELAXED) & 1) == 0, "Out of memory for limbo batches inside a critical section!");
+    while (__atomic_load_n(&thread->m_owner->m_epoch, __ATOMIC_ACQUIRE) < epoch + 2) {
+        if (!epoch_try_advance(thread->m_owner))
+            sched_yield();
+    }
+    return make_free_status((free_status_t) nax_free(thread->m_owner->child, memory));
+}
+
+
+allocation_result_t epoch_retire(epoch_thread_t* thread, byte_t* memory) {
+    if (memory == 0) {
+        return make_free_status(FREE_STATUS_SUCCEEDED);
+    }
+
+    if (++thread->m_frees >= EPOCH_ADVANCE_INTERVAL) {
+        thread->m_frees = 0;
+        epoch_try_advance(thread->m_owner);
+    }
+
+    u64 epoch = __atomic_load_n(&thread->m_owner->m_epoch, __ATOMIC_ACQUIRE);
+    epoch_limbo_t* limbo = &thread->m_limbo[epoch % 3];
+    if (limbo->epoch != epoch) {
+        // Whatever is in this slot is from `epoch - 3` or earlier and safe to release.
+        epoch_release_limbo(thread, limbo);
+        limbo->epoch = epoch;
+    }
+
+    epoch_batch_t* batch = limbo->batches;
+    if (batch == 0 || batch->count == EPOCH_BATCH_CAPACITY) {
+        epoch_batch_t* fresh = thread->m_spare;
+        if (fresh != 0) {
+            thread->m_spare = 0;
+        } else {
+            fresh = (epoch_batch_t*) nax_allocate_type(allocator_malloc, epoch_batch_t, 1);
+            if (!allocation_succeeded((byte_t*) fresh))
+                return epoch_retire_unbatched(thread, memory, epoch);
+        }
+        fresh->count = 0;
+        fresh->next  = batch;
+        limbo->batches = fresh;
+        batch = fresh;
+    }
+    batch->memory[batch->count++] = memory;
+    return make_free_status(FREE_STATUS_SUCCEEDED);
+}
+
+
+// Waits until everything this thread retired has been released, then gives up the record.
+void epoch_unregister(epoch_thread_t* thread) {
+    epoch_exit(thread);
+    while (epoch_collect(thread) != 0) {
+        if (!epoch_try_advance(thread->m_owner))
+            sched_yield();
+    }
+    if (thread->m_spare != 0) {
+        nax_free(allocator_malloc, (byte_t*) thread->m_spare);
+        thread->m_spare = 0;
+    }
+    for (u32 i = 0; i < EPOCH_MAX_PER_THREAD; ++i) {
+        if (epoch_registrations[i].thread == thread)
+            epoch_registrations[i] = (epoch_registration_t) { 0 };
+    }
+    thread->m_frees = 0;
+    __atomic_store_n(&thread->m_in_use, 0, __ATOMIC_RELEASE);
+}
+
+
+// Only safe when no thread is inside a critical section. A child that can't FREE_ALL still gets
+// back everything that was waiting in limbo, one FREE at a time.
+allocation_result_t epoch_free_all(allocator_epoch_t* allocator) {
+    allocation_arguments_t arguments = { .mode=FREE_ALL };
+    allocation_result_t result = allocator->child.procedure(allocator->child.data, arguments);
+    int child_freed_all = free_succeeded(result.result);
+
+    u32 count = __atomic_load_n(&allocator->m_thread_count, __ATOMIC_ACQUIRE);
+    for (u32 i = 0; i < count; ++i) {
+        epoch_thread_t* thread = &allocator->m_threads[i];
+        for (u32 j = 0; j < 3; ++j) {
+            epoch_limbo_t* limbo = &thread->m_limbo[j];
+            epoch_batch_t* batch = limbo->batches;
+            while (batch != 0) {
+                epoch_batch_t* next = batch->next;
+                if (!child_freed_all) {
+                    for (u32 k = 0; k < batch->count; ++k)
+                        nax_free(allocator->child, batch->memory[k]);
+                }
+                nax_free(allocator_malloc, (byte_t*) batch);
+                batch = next;
+            }
+            limbo->batches = 0;
+        }
+    }
+    return result;
+}
+
+
+allocation_result_t allocator_epoch_proc(void* allocator_raw, allocation_arguments_t arguments) {
+    allocator_epoch_t* allocator = (allocator_epoch_t*) allocator_raw;
+    switch (arguments.mode) {
+        case FREE:
+        {
+            epoch_thread_t* thread = epoch_current_thread(allocator);
+            ASSERTF(thread != 0, "Thread is not registered with the allocator!");
+            return epoch_retire(thread, arguments.free.memory);
+        }
+        case FREE_ALL:
+            return epoch_free_all(allocator);
+
+        // @NOTE: A RESIZE may move and free the old memory right away, which a reader could still hold.
+        case RESIZE:
+            return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
+
+        case ALLOCATE:
+        case ALLOCATE_ALIGNED:
+        case ALLOCATE_ALL:
+        case QUERY_USED:
+        case QUERY_OWNS:
+        case QUERY_CAPACITY:
+        case QUERY_ALIGNMENT:
+        case QUERY_GOOD_SIZE:
+        case QUERY_ALLOCATION_SIZE:
+        case QUERY_USABLE_SIZE:
+            return allocator->child.procedure(allocator->child.data, arguments);
+    }
+}
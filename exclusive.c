@@ -0,0 +1,128 @@
+/* Gives every allocation cache lines of its own, so objects written by different threads
+ * don't falsely share a line.
+ *
+ * Sizes are rounded up to a multiple of `line_size` and every allocation is aligned to it,
+ * so nothing else the parent hands out can land on the same lines. Objects that are only
+ * read, or only used by one thread, are better off packed and shouldn't go through this.
+ *
+ * A RESIZE that the parent moves to memory that isn't aligned to a line is moved once more.
+ * That frees the parent's block on its own, which a stack would take as rewinding past the
+ * new one. A stack keeps up to 64 bytes of alignment when it moves a block, so over a stack
+ * (or the persistent arena on top of one) the line size can't be more than that.
+ */
+typedef struct {
+    allocator_t parent;
+    word_t      line_size;
+} allocator_exclusive_t;
+
+
+allocator_exclusive_t exclusive_init(allocator_t parent, word_t line_size) {
+    ASSERTF(is_power_of_two(line_size), "Line size must be a power of two!");
+    int is_stack = parent.procedure == allocator_stack_proc || parent.procedure == allocator_persistent_proc;
+    ASSERTF(!is_stack || line_size <= 64, "A stack only keeps 64 bytes of alignment when it moves a block, not %zu!", (size_t) line_size);
+    return (allocator_exclusive_t) { .parent=parent, .line_size=line_size };
+}
+
+
+// Whole lines, and at least one even for an empty allocation so it doesn't share.
+word_t exclusive_lines(allocator_exclusive_t* allocator, word_t size) {
+    return (word_t) align_address((size > 0) ? (size_t) size : 1, (size_t) allocator->line_size);
+}
+
+
+allocation_result_t exclusive_allocate_aligned(allocator_exclusive_t* allocator, word_t size, word_t alignment) {
+    word_t  line   = allocator->line_size;
+    byte_t* memory = nax_allocate_aligned(allocator->parent, exclusive_lines(allocator, size), (alignment > line) ? alignment : line);
+    if (!allocation_succeeded(memory)) {
+        return make_allocation_error((allocation_status_t)(size_t) memory);
+    }
+    return make_allocation_result(memory);
+}
+
+
+allocation_result_t exclusive_resize(allocator_exclusive_t* allocator, byte_t* memory, word_t old_size, word_t new_size) {
+    word_t line = allocator->line_size;
+    if (memory == 0) {
+        return exclusive_allocate_aligned(allocator, new_size, line);
+    }
+    word_t old_lines = exclusive_lines(allocator, old_size);
+    word_t new_lines = exclusive_lines(allocator, new_size);
+    if (new_lines <= old_lines) {
+        return make_allocation_result(memory);
+    }
+
+    byte_t* resized = nax_resize(allocator->parent, memory, new_lines, old_lines);
+    if (!allocation_succeeded(resized)) {
+        return make_allocation_error((allocation_status_t)(size_t) resized);
+    }
+    if (((size_t) resized & (size_t) (line - 1)) == 0) {
+        return make_allocation_result(resized);
+    }
+
+    allocation_result_t result = exclusive_allocate_aligned(allocator, new_size, line);
+    if (allocation_succeeded(result.memory)) {
+        memcpy(result.memory, resized, (size_t) old_size);
+        nax_free(allocator->parent, resized);
+    }
+    return result;
+}
+
+
+allocation_result_t exclusive_alignment(allocator_exclusive_t* allocator) {
+    size_t alignment = nax_query_alignment(allocator->parent);
+    if (alignment == ALLOCATION_QUERY_UNSUPPORTED || alignment < (size_t) allocator->line_size) {
+        alignment = (size_t) allocator->line_size;
+    }
+    return make_query_result(alignment);
+}
+
+allocation_result_t exclusive_good_size(allocator_exclusive_t* allocator) {
+    size_t good_size = nax_query_good_size(allocator->parent);
+    if (good_size == ALLOCATION_QUERY_UNSUPPORTED) {
+        return make_query_result((size_t) allocator->line_size);
+    }
+    return make_query_result(align_address(good_size, (size_t) allocator->line_size));
+}
+
+allocation_result_t exclusive_allocation_size(allocator_exclusive_t* allocator, word_t size, word_t alignment) {
+    word_t line  = allocator->line_size;
+    size_t query = nax_query_allocation_size(allocator->parent, exclusive_lines(allocator, size), (alignment > line) ? alignment : line);
+    if (query == ALLOCATION_QUERY_UNSUPPORTED) {
+        return make_query_result(query);
+    }
+    return make_query_result(query & ~(size_t) (line - 1));
+}
+
+// Only whole lines count, the bytes of a partial line at the end may be shared with a neighbour.
+allocation_result_t exclusive_usable_size(allocator_exclusive_t* allocator, const byte_t* memory) {
+    size_t query = nax_query_usable_size(allocator->parent, memory);
+    if (query == ALLOCATION_QUERY_UNSUPPORTED) {
+        return make_query_result(query);
+    }
+    return make_query_result(query & ~(size_t) (allocator->line_size - 1));
+}
+
+
+allocation_result_t allocator_exclusive_proc(void* allocator_raw, allocation_arguments_t arguments) {
+    allocator_exclusive_t* allocator = (allocator_exclusive_t*) allocator_raw;
+    switch (arguments.mode) {
+        case ALLOCATE:          return exclusive_allocate_aligned(allocator, arguments.allocate.size, allocator->line_size);
+        case ALLOCATE_ALIGNED:  return exclusive_allocate_aligned(allocator, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
+        case RESIZE:            return exclusive_resize(allocator, arguments.resize.memory, arguments.resize.old_size, arguments.resize.new_size);
+        case QUERY_ALIGNMENT:   return exclusive_alignment(allocator);
+        case QUERY_GOOD_SIZE:   return exclusive_good_size(allocator);
+        case QUERY_ALLOCATION_SIZE: return exclusive_allocation_size(allocator, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
+        case QUERY_USABLE_SIZE:     return exclusive_usable_size(allocator, arguments.usable_size.memory);
+
+        case FREE:
+        case FREE_ALL:
+        case QUERY_USED:
+        case QUERY_OWNS:
+        case QUERY_CAPACITY:
+            return allocator->parent.procedure(allocator->parent.data, arguments);
+
+        // @NOTE: Unsupported, the rest of the parent may start in the middle of a line.
+        case ALLOCATE_ALL:
+            return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
+    }
+}
@@ -33,9 +33,30 @@ allocation_result_t fallback_allocate_aligned(allocator_fallback_t* allocator, w
 }
 
 
+// Resizes in whichever allocator owns the block. A block the primary can't resize moves to the
+// secondary, the same as an allocation the primary can't serve.
 allocation_result_t fallback_resize(allocator_fallback_t* allocator, byte_t* memory, word_t old_size, word_t new_size) {
-    ASSERTF(0, "TODO");
-    return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
+    if (memory == 0) {
+        return fallback_allocate(allocator, new_size);
+    }
+
+    int         in_primary = nax_query_owns(allocator->primary, memory) == 1;
+    allocator_t owner      = in_primary ? allocator->primary : allocator->secondary;
+    byte_t*     result     = nax_resize(owner, memory, new_size, old_size);
+    if (allocation_succeeded(result)) {
+        return make_allocation_result(result);
+    }
+    if (!in_primary) {
+        return make_allocation_error((allocation_status_t)(size_t) result);
+    }
+
+    result = nax_allocate_aligned(allocator->secondary, new_size, (word_t) address_alignment((size_t) memory, 64));
+    if (!allocation_succeeded(result)) {
+        return make_allocation_error((allocation_status_t)(size_t) result);
+    }
+    memcpy(result, memory, (size_t) ((old_size < new_size) ? old_size : new_size));
+    nax_free(allocator->primary, memory);
+    return make_allocation_result(result);
 }
 
 
@@ -93,6 +114,20 @@ allocation_result_t fallback_good_size(allocator_fallback_t* allocator) {
     return make_query_result(minimum_good_size);
 }
 
+// What the primary would give, unless it can never allocate the size.
+allocation_result_t fallback_allocation_size(allocator_fallback_t* allocator, word_t size, word_t alignment) {
+    size_t query_1 = nax_query_allocation_size(allocator->primary, size, alignment);
+    if (query_1 != ALLOCATION_QUERY_UNSUPPORTED && query_1 != 0) {
+        return make_query_result(query_1);
+    }
+    return make_query_result(nax_query_allocation_size(allocator->secondary, size, alignment));
+}
+
+allocation_result_t fallback_usable_size(allocator_fallback_t* allocator, const byte_t* memory) {
+    allocator_t owner = (nax_query_owns(allocator->primary, memory) == 1) ? allocator->primary : allocator->secondary;
+    return make_query_result(nax_query_usable_size(owner, memory));
+}
+
 allocation_result_t fallback_capacity(allocator_fallback_t* allocator) {
     size_t query_1 = nax_query_capacity(allocator->primary);
     size_t query_2 = nax_query_capacity(allocator->secondary);
@@ -136,5 +171,7 @@ allocation_result_t allocator_fallback_proc(void* allocator_raw, allocation_argu
         case QUERY_CAPACITY:    return fallback_capacity(allocator);
         case QUERY_ALIGNMENT:   return fallback_alignment(allocator);
         case QUERY_GOOD_SIZE:   return fallback_good_size(allocator);
+        case QUERY_ALLOCATION_SIZE: return fallback_allocation_size(allocator, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
+        case QUERY_USABLE_SIZE:     return fallback_usable_size(allocator, arguments.usable_size.memory);
     }
 }
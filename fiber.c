@@ -0,0 +1,198 @@
+/* Hands out fixed-size stacks for fibers, each with a guard page below it.
+ *
+ * All stacks live in one reserved region, laid out as [guard][stack][guard][stack]...,
+ * where every guard page is PROT_NONE so an overflow faults instead of overwriting the
+ * neighbour. A slot is only made accessible the first time it's handed out, and pages of a
+ * stack are committed by the OS as the fiber touches them, so a stack that never grows
+ * deep never costs more than the pages it used.
+ *
+ * Freed stacks are kept in a LIFO cache, so the next fiber gets the stack that was used
+ * most recently and is still resident. Only `cache_budget` bytes of cached stacks are
+ * kept committed; past that, the coldest stacks at the bottom of the cache are decommitted
+ * with madvise and will be faulted back in as zeroed pages when reused.
+ *
+ * ALLOCATE returns the lowest address of the stack. As stacks grow down, a fiber starts at
+ * `fiber_stack_top`.
+ */
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+typedef struct {
+    byte_t* m_region;
+    size_t  m_region_size;
+    size_t  m_page_size;
+    size_t  m_stack_size;       // Usable size of a stack, a multiple of the page size.
+    size_t  m_cache_budget;     // Bytes of cached stacks that stay committed.
+    u32     m_max_stacks;
+    u32     m_untouched;        // Slots from here on have never been handed out.
+    u32     m_live;
+    u32     m_cached;
+    u32     m_cold;             // Cached stacks below this index are decommitted.
+    u32*    m_cache;            // Free slots, the most recently freed on top.
+    u64*    m_in_use;           // A bit per slot that is handed out, to catch double frees.
+} allocator_fiber_t;
+
+
+int fiber_init(allocator_fiber_t* allocator, size_t stack_size, u32 max_stacks, size_t cache_budget) {
+    memset(allocator, 0, sizeof(*allocator));
+    allocator->m_page_size    = (size_t) sysconf(_SC_PAGESIZE);
+    allocator->m_stack_size   = align_address(stack_size, allocator->m_page_size);
+    allocator->m_cache_budget = cache_budget;
+    allocator->m_max_stacks   = max_stacks;
+    allocator->m_region_size  = (allocator->m_page_size + allocator->m_stack_size) * max_stacks;
+
+    // Only address space is reserved here, nothing is accessible or committed yet.
+    byte_t* region = (byte_t*) mmap(0, allocator->m_region_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED)
+        return 0;
+
+    allocator->m_cache = (u32*) nax_allocate_type(allocator_malloc, u32, max_stacks);
+    if (!allocation_succeeded((byte_t*) allocator->m_cache)) {
+        munmap(region, allocator->m_region_size);
+        return 0;
+    }
+    allocator->m_in_use = (u64*) nax_allocate_type(allocator_malloc, u64, (max_stacks + 63) / 64);
+    if (!allocation_succeeded((byte_t*) allocator->m_in_use)) {
+        nax_free(allocator_malloc, (byte_t*) allocator->m_cache);
+        munmap(region, allocator->m_region_size);
+        return 0;
+    }
+    memset(allocator->m_in_use, 0, ((max_stacks + 63) / 64) * sizeof(u64));
+    allocator->m_region = region;
+    return 1;
+}
+
+void fiber_destroy(allocator_fiber_t* allocator) {
+    munmap(allocator->m_region, allocator->m_region_size);
+    nax_free(allocator_malloc, (byte_t*) allocator->m_cache);
+    nax_free(allocator_malloc, (byte_t*) allocator->m_in_use);
+    memset(allocator, 0, sizeof(*allocator));
+}
+
+
+byte_t* fiber_slot_stack(allocator_fiber_t* allocator, u32 slot) {
+    return allocator->m_region + (size_t) slot * (allocator->m_page_size + allocator->m_stack_size) + allocator->m_page_size;
+}
+
+byte_t* fiber_stack_top(allocator_fiber_t* allocator, byte_t* stack) {
+    return stack + allocator->m_stack_size;
+}
+
+
+int fiber_owns(allocator_fiber_t* allocator, const byte_t* memory) {
+    return allocator->m_region <= memory && memory < allocator->m_region + allocator->m_region_size;
+}
+
+
+// Flips whether `slot` is handed out. Returns the previous state.
+int fiber_toggle_in_use(allocator_fiber_t* allocator, u32 slot) {
+    u64 bit = (u64) 1 << (slot % 64);
+    int was_in_use = (allocator->m_in_use[slot / 64] & bit) != 0;
+    allocator->m_in_use[slot / 64] ^= bit;
+    return was_in_use;
+}
+
+
+allocation_result_t fiber_allocate(allocator_fiber_t* allocator, word_t size) {
+    if ((size_t) size > allocator->m_stack_size) {
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+
+    if (allocator->m_cached != 0) {
+        u32 slot = allocator->m_cache[--allocator->m_cached];
+        if (allocator->m_cold > allocator->m_cached)
+            allocator->m_cold = allocator->m_cached;
+        fiber_toggle_in_use(allocator, slot);
+        allocator->m_live++;
+        return make_allocation_result(fiber_slot_stack(allocator, slot));
+    }
+
+    if (allocator->m_untouched == allocator->m_max_stacks) {
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+    byte_t* stack = fiber_slot_stack(allocator, allocator->m_untouched);
+    if (mprotect(stack, allocator->m_stack_size, PROT_READ | PROT_WRITE) != 0) {
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+    fiber_toggle_in_use(allocator, allocator->m_untouched);
+    allocator->m_untouched++;
+    allocator->m_live++;
+    return make_allocation_result(stack);
+}
+
+
+// Decommits the coldest cached stacks until the committed ones fit in the budget.
+void fiber_trim_cache(allocator_fiber_t* allocator) {
+    while ((size_t) (allocator->m_cached - allocator->m_cold) * allocator->m_stack_size > allocator->m_cache_budget) {
+        byte_t* stack = fiber_slot_stack(allocator, allocator->m_cache[allocator->m_cold]);
+        madvise(stack, allocator->m_stack_size, MADV_DONTNEED);
+        allocator->m_cold++;
+    }
+}
+
+
+allocation_result_t fiber_free(allocator_fiber_t* allocator, byte_t* memory) {
+    if (memory == 0) {
+        return make_free_status(FREE_STATUS_SUCCEEDED);
+    }
+    if (!fiber_owns(allocator, memory)) {
+        return make_free_status(FREE_STATUS_CALLED_ON_NON_OWNED_MEMORY);
+    }
+
+    size_t offset = (size_t) (memory - allocator->m_region);
+    size_t stride = allocator->m_page_size + allocator->m_stack_size;
+    ASSERTF(offset % stride == allocator->m_page_size, "Memory is not the start of a fiber stack!");
+
+    u32 slot = (u32) (offset / stride);
+    ASSERTF(slot < allocator->m_untouched, "Stack %u was never handed out!", slot);
+    int was_in_use = fiber_toggle_in_use(allocator, slot);
+    ASSERTF(was_in_use, "Stack %u was freed twice!", slot);
+    allocator->m_cache[allocator->m_cached++] = slot;
+    allocator->m_live--;
+    fiber_trim_cache(allocator);
+    return make_free_status(FREE_STATUS_SUCCEEDED);
+}
+
+
+// Every stack handed out so far goes back in the cache, decommitted.
+allocation_result_t fiber_free_all(allocator_fiber_t* allocator) {
+    for (u32 slot = 0; slot < allocator->m_untouched; ++slot) {
+        madvise(fiber_slot_stack(allocator, slot), allocator->m_stack_size, MADV_DONTNEED);
+        allocator->m_cache[slot] = allocator->m_untouched - 1 - slot;
+    }
+    memset(allocator->m_in_use, 0, ((allocator->m_max_stacks + 63) / 64) * sizeof(u64));
+    allocator->m_cached = allocator->m_untouched;
+    allocator->m_cold   = allocator->m_untouched;
+    allocator->m_live   = 0;
+    return make_free_status(FREE_STATUS_SUCCEEDED);
+}
+
+
+allocation_result_t allocator_fiber_proc(void* allocator_raw, allocation_arguments_t arguments) {
+    allocator_fiber_t* allocator = (allocator_fiber_t*) allocator_raw;
+    switch (arguments.mode) {
+        case ALLOCATE:          return fiber_allocate(allocator, arguments.allocate.size);
+        case FREE:              return fiber_free(allocator, arguments.free.memory);
+        case FREE_ALL:          return fiber_free_all(allocator);
+        case QUERY_USED:        return make_query_result((size_t) allocator->m_live * allocator->m_stack_size);
+        case QUERY_OWNS:        return make_query_result((size_t) fiber_owns(allocator, arguments.owns.memory));
+        case QUERY_CAPACITY:    return make_query_result((size_t) allocator->m_max_stacks * allocator->m_stack_size);
+        case QUERY_ALIGNMENT:   return make_query_result(allocator->m_page_size);
+        case QUERY_GOOD_SIZE:   return make_query_result(allocator->m_stack_size);
+        case QUERY_ALLOCATION_SIZE:
+            return make_query_result(((size_t) arguments.allocate_aligned.size <= allocator->m_stack_size) ? allocator->m_stack_size : 0);
+        case QUERY_USABLE_SIZE:
+            return make_query_result(fiber_owns(allocator, arguments.usable_size.memory) ? allocator->m_stack_size : 0);
+
+        case ALLOCATE_ALIGNED:
+            if ((size_t) arguments.allocate_aligned.alignment > allocator->m_page_size)
+                return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
+            return fiber_allocate(allocator, arguments.allocate_aligned.size);
+
+        // @NOTE: Unsupported, a stack can't grow past its guard page.
+        case ALLOCATE_ALL:
+        case RESIZE:
+            return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
+    }
+}
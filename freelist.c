@@ -1,7 +1,15 @@
 typedef struct {
-    u32 one_past_next;
+    u32 one_past_next;   // 0 means the list continues with the released runs, then the untouched blocks.
 } freelist_node_t;
 
+// The first block of a run of free blocks whose memory, apart from this header, may have been
+// given back to the OS. The run's other blocks hold no links and are handed out last first,
+// so nothing ever reads them; runs are kept in a list of their own.
+typedef struct {
+    u32 one_past_next;
+    u32 end;
+} freelist_run_t;
+
 
 typedef struct {
     byte_t* m_memory;
@@ -9,6 +17,8 @@ typedef struct {
     u32     m_block_size;
     u32     m_count;
     u32     m_used;
+    u32     m_untouched;    // Blocks from here on are free and handed out in order, so their memory is never read.
+    u32     m_first_run;    // One past the head of the first released run, 0 if there is none.
 } allocator_freelist_t;
 
 
@@ -24,16 +34,48 @@ allocator_freelist_t freelist_init(byte_t* memory, u32 block_size, u32 count) {
             .m_block_size = block_size,
             .m_count = count,
             .m_used  = 0,
+            .m_untouched = 0,
+            .m_first_run = 0,
     };
-    memset(freelist.m_memory, 0, freelist_capacity(&freelist));
     return freelist;
 }
 
+// Fits as many blocks as it can in `capacity` and starts them `color` cache lines in, wrapping
+// around in the space left over. Pools that all start on a page boundary would otherwise put
+// their first blocks, which are the hottest, in the same cache sets.
+allocator_freelist_t freelist_init_colored(byte_t* memory, size_t capacity, u32 block_size, u32 color) {
+    u32    count  = (u32) (capacity / block_size);
+    size_t slack  = capacity - (size_t) count * block_size;
+    u32    colors = (u32) (slack / CACHE_LINE_SIZE) + 1;
+    return freelist_init(memory + (size_t) (color % colors) * CACHE_LINE_SIZE, block_size, count);
+}
+
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcast-align"
+freelist_run_t* freelist_run(allocator_freelist_t* allocator, u32 one_past_index) {
+    return (freelist_run_t*) &allocator->m_memory[(one_past_index - 1) * allocator->m_block_size];
+}
+#pragma clang diagnostic pop
+
 
 allocation_result_t freelist_allocate(allocator_freelist_t* allocator, word_t size) {
     ASSERTF((u32) size <= allocator->m_block_size, "Allocating more than block size!");
 
-    if (allocator->m_first_free >= freelist_capacity(allocator)) {   // Out of memory.
+    if (allocator->m_first_free == allocator->m_untouched && allocator->m_first_run != 0) {
+        u32             index = allocator->m_first_run - 1;
+        freelist_run_t* run   = freelist_run(allocator, allocator->m_first_run);
+        if (run->end > index + 1) {
+            run->end -= 1;
+            index = run->end;
+        } else {
+            allocator->m_first_run = run->one_past_next;
+        }
+        allocator->m_used += 1;
+        return make_allocation_result(&allocator->m_memory[index * allocator->m_block_size]);
+    }
+
+    if (allocator->m_first_free >= allocator->m_count) {   // Out of memory.
         return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
     }
 
@@ -43,21 +85,36 @@ allocation_result_t freelist_allocate(allocator_freelist_t* allocator, word_t si
     ASSERTF(align_address((size_t) element, ALIGN_OF(freelist_node_t)) == (size_t) element, "Element must be aligned to freelist_node_t");
 #pragma clang diagnostic pop
 
-    allocator->m_first_free = (element->one_past_next == 0) ? allocator->m_first_free + 1 : element->one_past_next - 1;
+    if (allocator->m_first_free == allocator->m_untouched) {
+        allocator->m_untouched += 1;
+        allocator->m_first_free = allocator->m_untouched;
+    } else {
+        allocator->m_first_free = (element->one_past_next == 0) ? allocator->m_untouched : element->one_past_next - 1;
+    }
     allocator->m_used += 1;
     return make_allocation_result((byte_t*) element);
 }
 
 
 allocation_result_t freelist_resize(allocator_freelist_t* allocator, byte_t* memory, word_t old_size, word_t new_size)  {
-    ASSERTF(0, "TODO");
-    return make_allocation_error(ALLOCATION_STATUS_SUCCEEDED);
+    if (memory == 0) {
+        return freelist_allocate(allocator, new_size);
+    }
+
+    // Every block is the same size, so a resize either fits in the block or can't be done.
+    ASSERTF(freelist_owns(allocator, memory), "Allocator does not own the memory!");
+    if ((u32) new_size <= allocator->m_block_size) {
+        return make_allocation_result(memory);
+    } else {
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
 }
 
 
 allocation_result_t freelist_free(allocator_freelist_t* allocator, byte_t* memory)  {
-    ASSERTF(freelist_owns(allocator, memory), "Allocator does not own the memory!");
-    ASSERTF(allocator->m_first_free <= freelist_capacity(allocator), "Allocator was empty!");
+    if (!freelist_owns(allocator, memory))
+        return make_free_status(FREE_STATUS_CALLED_ON_NON_OWNED_MEMORY);
+    ASSERTF(allocator->m_first_free <= allocator->m_count, "Allocator was empty!");
 
     u32 offset = (u32) ((byte_t*)memory - (byte_t*)allocator->m_memory);
     ASSERTF(offset % allocator->m_block_size == 0, "Invalid offset of pointer!");
@@ -68,7 +125,7 @@ allocation_result_t freelist_free(allocator_freelist_t* allocator, byte_t* memor
     ASSERTF(align_address((size_t) element, ALIGN_OF(freelist_node_t)) == (size_t) element, "Element must be aligned to freelist_node_t");
 #pragma clang diagnostic pop
 
-    element->one_past_next = allocator->m_first_free + 1;
+    element->one_past_next = (allocator->m_first_free == allocator->m_untouched) ? 0 : allocator->m_first_free + 1;
     allocator->m_first_free = offset / allocator->m_block_size;
     allocator->m_used -= 1;
     return make_free_status(FREE_STATUS_SUCCEEDED);
@@ -78,17 +135,112 @@ allocation_result_t freelist_free(allocator_freelist_t* allocator, byte_t* memor
 allocation_result_t freelist_free_all(allocator_freelist_t* allocator)  {
     allocator->m_first_free = 0;
     allocator->m_used = 0;
-    memset(allocator->m_memory, 0, freelist_capacity(allocator));
+    allocator->m_untouched = 0;
+    allocator->m_first_run = 0;
     return make_free_status(FREE_STATUS_SUCCEEDED);
 }
 
 
 int freelist_owns(allocator_freelist_t* allocator, const byte_t* memory) {
-    int owns = allocator->m_memory <= memory && memory <= allocator->m_memory + allocator->m_count * allocator->m_block_size;
+    int owns = allocator->m_memory <= memory && memory < allocator->m_memory + allocator->m_count * allocator->m_block_size;
     return owns;
 }
 
 
+// Clears the bits of the blocks in released runs, leaving the free blocks that belong in the list.
+void freelist_unmark_runs(allocator_freelist_t* allocator, u64* free_blocks) {
+    for (u32 one_past = allocator->m_first_run; one_past != 0; one_past = freelist_run(allocator, one_past)->one_past_next) {
+        for (u32 i = one_past - 1; i < freelist_run(allocator, one_past)->end; ++i)
+            free_blocks[i / 64] &= ~(1ULL << (i % 64));
+    }
+}
+
+// Sets a bit in `free_blocks`, which must have room for `m_count` bits, for every free block.
+void freelist_mark_free(allocator_freelist_t* allocator, u64* free_blocks) {
+    memset(free_blocks, 0, ((size_t) allocator->m_count + 63) / 64 * sizeof(u64));
+    for (u32 i = allocator->m_untouched; i < allocator->m_count; ++i)
+        free_blocks[i / 64] |= 1ULL << (i % 64);
+    for (u32 one_past = allocator->m_first_run; one_past != 0; one_past = freelist_run(allocator, one_past)->one_past_next) {
+        for (u32 i = one_past - 1; i < freelist_run(allocator, one_past)->end; ++i)
+            free_blocks[i / 64] |= 1ULL << (i % 64);
+    }
+
+    u32 index = allocator->m_first_free;
+    while (index < allocator->m_untouched) {
+        free_blocks[index / 64] |= 1ULL << (index % 64);
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcast-align"
+        freelist_node_t* element = (freelist_node_t*) &allocator->m_memory[index * allocator->m_block_size];
+#pragma clang diagnostic pop
+        index = (element->one_past_next == 0) ? allocator->m_untouched : element->one_past_next - 1;
+    }
+}
+
+// The first block of the run of free blocks at the end.
+u32 freelist_free_tail(allocator_freelist_t* allocator, const u64* free_blocks) {
+    u32 index = allocator->m_count;
+    while (index > 0 && (free_blocks[(index - 1) / 64] & (1ULL << ((index - 1) % 64))))
+        index -= 1;
+    return index;
+}
+
+// Makes the free blocks [head, end) a released run, after which the memory of all but the first
+// `sizeof(freelist_run_t)` bytes can be given back to the OS. The head's link is overwritten, so the
+// list must be relinked with `freelist_untouch_from` before it's used again.
+void freelist_add_run(allocator_freelist_t* allocator, u32 head, u32 end) {
+    ASSERTF(allocator->m_block_size >= sizeof(freelist_run_t) && head < end, "Invalid run!");
+    freelist_run_t* run = freelist_run(allocator, head + 1);
+    run->one_past_next = allocator->m_first_run;
+    run->end           = end;
+    allocator->m_first_run = head + 1;
+}
+
+// Relinks the free list in address order so that every block from `index` is untouched again,
+// after which their memory can be given back to the OS. All those blocks must be free. Released
+// runs are cut at `index`, and their blocks are cleared in `free_blocks` and left out of the list.
+void freelist_untouch_from(allocator_freelist_t* allocator, u64* free_blocks, u32 index) {
+    ASSERTF(freelist_free_tail(allocator, free_blocks) <= index, "Blocks after the index are in use!");
+
+    u32 one_past = allocator->m_first_run;
+    allocator->m_first_run = 0;
+    while (one_past != 0) {
+        freelist_run_t* run  = freelist_run(allocator, one_past);
+        u32             next = run->one_past_next;
+        if (one_past - 1 < index) {
+            if (run->end > index)
+                run->end = index;
+            run->one_past_next = allocator->m_first_run;
+            allocator->m_first_run = one_past;
+            for (u32 i = one_past - 1; i < run->end; ++i)
+                free_blocks[i / 64] &= ~(1ULL << (i % 64));
+        }
+        one_past = next;
+    }
+
+    u32 first = index;
+    for (u32 i = index; i > 0; --i) {
+        u32 block = i - 1;
+        if (!(free_blocks[block / 64] & (1ULL << (block % 64))))
+            continue;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcast-align"
+        freelist_node_t* element = (freelist_node_t*) &allocator->m_memory[block * allocator->m_block_size];
+#pragma clang diagnostic pop
+        element->one_past_next = (first == index) ? 0 : first + 1;
+        first = block;
+    }
+    allocator->m_untouched  = index;
+    allocator->m_first_free = first;
+}
+
+
+// What every block is aligned to, which depends on where the memory starts as well as the block size.
+size_t freelist_alignment(allocator_freelist_t* allocator) {
+    size_t bits = (size_t) allocator->m_memory | allocator->m_block_size;
+    return bits & -bits;
+}
+
+
 size_t freelist_capacity(allocator_freelist_t* allocator) {
     return allocator->m_block_size * allocator->m_count;
 }
@@ -98,12 +250,54 @@ size_t freelist_used(allocator_freelist_t* allocator) {
 }
 
 
+// A 32-bit reference into a freelist: one past the block index, like `one_past_next`, so that
+// 0 can be null. Can address far more than 4 GiB, as it counts blocks and not bytes.
+typedef u32 freelist_relative_t;
+
+freelist_relative_t freelist_to_relative(allocator_freelist_t* allocator, const void* memory) {
+    if (memory == 0) {
+        return 0;
+    }
+    ASSERTF(freelist_owns(allocator, (const byte_t*) memory), "Memory is not in the freelist!");
+    size_t offset = (size_t) ((const byte_t*) memory - allocator->m_memory);
+    ASSERTF(offset % allocator->m_block_size == 0, "Memory is not the start of a block!");
+    return (freelist_relative_t) (offset / allocator->m_block_size) + 1;
+}
+
+void* freelist_from_relative(allocator_freelist_t* allocator, freelist_relative_t index) {
+    if (index == 0) {
+        return 0;
+    }
+    ASSERTF(index <= allocator->m_count, "Block %u is not in the freelist!", index - 1);
+    return allocator->m_memory + (size_t) (index - 1) * allocator->m_block_size;
+}
+
+// Returns 0 when out of memory.
+freelist_relative_t freelist_allocate_relative(allocator_freelist_t* allocator) {
+    allocation_result_t result = freelist_allocate(allocator, allocator->m_block_size);
+    if (!allocation_succeeded(result.memory)) {
+        return 0;
+    }
+    return freelist_to_relative(allocator, result.memory);
+}
+
+allocation_result_t freelist_free_relative(allocator_freelist_t* allocator, freelist_relative_t index) {
+    if (index == 0) {
+        return make_free_status(FREE_STATUS_SUCCEEDED);
+    }
+    return freelist_free(allocator, (byte_t*) freelist_from_relative(allocator, index));
+}
+
+#define freelist_pointer(allocator, type_, index) ((type_*) freelist_from_relative(allocator, index))
+
+
 allocation_result_t allocator_freelist_proc(void* allocator_raw, allocation_arguments_t arguments) {
     allocator_freelist_t* allocator = (allocator_freelist_t*) allocator_raw;
     switch (arguments.mode) {
         case ALLOCATE:          return freelist_allocate(allocator, arguments.allocate.size);
         case ALLOCATE_ALIGNED:
-            ASSERTF((u32) arguments.allocate_aligned.alignment == allocator->m_block_size, "Can only align at block size");
+            if ((size_t) arguments.allocate_aligned.alignment > freelist_alignment(allocator))
+                return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
             return freelist_allocate(allocator, arguments.allocate_aligned.size);
         case RESIZE:            return freelist_resize(allocator, arguments.resize.memory, arguments.resize.old_size, arguments.resize.new_size);
         case FREE:              return freelist_free(allocator, arguments.free.memory);
@@ -111,8 +305,14 @@ allocation_result_t allocator_freelist_proc(void* allocator_raw, allocation_argu
         case QUERY_USED:        return make_query_result(freelist_used(allocator));
         case QUERY_OWNS:        return make_query_result((size_t) freelist_owns(allocator, arguments.owns.memory));
         case QUERY_CAPACITY:    return make_query_result(freelist_capacity(allocator));
-        case QUERY_ALIGNMENT:
+        case QUERY_ALIGNMENT:   return make_query_result(freelist_alignment(allocator));
         case QUERY_GOOD_SIZE:   return make_query_result(allocator->m_block_size);
+        case QUERY_ALLOCATION_SIZE:
+            if ((size_t) arguments.allocate_aligned.alignment > freelist_alignment(allocator))
+                return make_query_result(0);
+            return make_query_result(((u32) arguments.allocate_aligned.size <= allocator->m_block_size) ? allocator->m_block_size : 0);
+        case QUERY_USABLE_SIZE:
+            return make_query_result(freelist_owns(allocator, arguments.usable_size.memory) ? allocator->m_block_size : 0);
         case ALLOCATE_ALL:      return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
     }
 }
@@ -0,0 +1,94 @@
+/* Keeps one copy of every distinct string, so interned strings compare by pointer.
+ *
+ * The characters are copied into memory from the interner's allocator, NUL-terminated, and
+ * the table maps them to their index in the order they were interned. With `arena` set, the
+ * strings and the table are only ever released together by rewinding the arena with
+ * FREE_ALL and calling `interner_reset`, instead of one FREE per string.
+ */
+
+typedef struct {
+    const char* string;
+    u32         length;
+} interned_t;
+
+typedef struct {
+    allocator_t allocator;
+    table_t     m_table;      // interned_t -> u32 index.
+} interner_t;
+
+
+interner_t interner_init(allocator_t allocator, int arena) {
+    return (interner_t) {
+            .allocator = allocator,
+            .m_table   = table_init_type(allocator, interned_t, u32, arena),
+    };
+}
+
+
+// Compares a stored string with one being looked up.
+int interner_equal(const void* stored_key, const void* key, __attribute__((unused)) u32 key_size) {
+    const interned_t* stored = (const interned_t*) stored_key;
+    const interned_t* lookup = (const interned_t*) key;
+    return stored->length == lookup->length && memcmp(stored->string, lookup->string, lookup->length) == 0;
+}
+
+
+// Returns the interned copy of the string, or 0 if it couldn't be allocated.
+const char* interner_intern(interner_t* interner, const char* string, u32 length) {
+    interned_t lookup = { .string=string, .length=length };
+    u32 hash     = table_hash(string, length);
+    u32 slot     = 0;
+    int inserted = 0;
+    allocation_result_t result = table_insert_slot(&interner->m_table, hash, &lookup, interner_equal, &slot, &inserted);
+    if (!allocation_succeeded(result.memory)) {
+        return 0;
+    }
+    if (!inserted) {
+        return table_key(&interner->m_table, interned_t, slot).string;
+    }
+
+    char* copy = (char*) nax_allocate(interner->allocator, (word_t) length + 1);
+    if (!allocation_succeeded((byte_t*) copy)) {
+        table_remove_slot(&interner->m_table, slot);
+        return 0;
+    }
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    table_key(&interner->m_table, interned_t, slot)   = (interned_t) { .string=copy, .length=length };
+    table_value(&interner->m_table, u32, slot)        = interner->m_table.m_count - 1;
+    return copy;
+}
+
+const char* interner_intern_cstring(interner_t* interner, const char* string) {
+    return interner_intern(interner, string, (u32) strlen(string));
+}
+
+
+// The index the string got when it was first interned, or -1 if it never was.
+i64 interner_find(interner_t* interner, const char* string, u32 length) {
+    interned_t lookup = { .string=string, .length=length };
+    i64 slot = table_find_with(&interner->m_table, table_hash(string, length), &lookup, interner_equal);
+    return (slot < 0) ? -1 : (i64) table_value(&interner->m_table, u32, slot);
+}
+
+
+u32 interner_count(interner_t* interner) {
+    return interner->m_table.m_count;
+}
+
+
+// Forgets every string without freeing, for when the arena they came from has been rewound.
+void interner_reset(interner_t* interner) {
+    table_reset(&interner->m_table);
+}
+
+void interner_free(interner_t* interner) {
+    table_t* table = &interner->m_table;
+    if (!table->arena) {
+        for (u32 slot = 0; slot < table->m_capacity; ++slot) {
+            if (table_slot_used(table, slot))
+                nax_free(interner->allocator, (byte_t*) table_key(table, interned_t, slot).string);
+        }
+    }
+    table_free(table);
+}
@@ -0,0 +1,264 @@
+/* Hands out page-aligned, fixed-size buffers for I/O from one long-lived region.
+ *
+ * The region is mapped once and never moves, so it can be registered with the kernel a
+ * single time (e.g. as fixed buffers for io_uring) and every buffer is addressed by
+ * `iopool_index`. Buffers are aligned to IOPOOL_ALIGNMENT and their size is a multiple of
+ * it, as O_DIRECT requires.
+ *
+ * Free buffers are kept in a LIFO stack, so the buffer that was just released, and is still
+ * in cache, is the next one handed out. Each thread can take an `iopool_cache_t` that keeps
+ * a few buffers of its own and only takes the pool's lock to move half of them at a time.
+ * It is used through `allocator_iopool_cache_proc`.
+ */
+#include <sched.h>
+#include <sys/mman.h>
+
+#define IOPOOL_ALIGNMENT       4096
+#define IOPOOL_CACHE_CAPACITY  16
+
+
+typedef struct {
+    byte_t* m_region;
+    size_t  m_region_size;
+    size_t  m_buffer_size;
+    u32     m_count;
+    u32     m_lock;
+    u32     m_free_count;
+    u32*    m_free;            // Indices of free buffers, the most recently freed on top.
+    u8*     m_is_free;         // Per buffer, 0 while it's handed out, wherever it's kept when free.
+} allocator_iopool_t;
+
+typedef struct {
+    allocator_iopool_t* pool;
+    u32 m_count;
+    u32 m_buffers[IOPOOL_CACHE_CAPACITY];
+} iopool_cache_t;
+
+
+int iopool_init(allocator_iopool_t* allocator, size_t buffer_size, u32 count) {
+    memset(allocator, 0, sizeof(*allocator));
+    allocator->m_buffer_size = align_address(buffer_size, IOPOOL_ALIGNMENT);
+    allocator->m_count       = count;
+    allocator->m_region_size = allocator->m_buffer_size * count;
+
+    byte_t* region = (byte_t*) mmap(0, allocator->m_region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return 0;
+
+    allocator->m_free = (u32*) nax_allocate_type(allocator_malloc, u32, count);
+    if (!allocation_succeeded((byte_t*) allocator->m_free)) {
+        munmap(region, allocator->m_region_size);
+        return 0;
+    }
+    allocator->m_is_free = nax_allocate_type(allocator_malloc, u8, count);
+    if (!allocation_succeeded(allocator->m_is_free)) {
+        nax_free(allocator_malloc, (byte_t*) allocator->m_free);
+        munmap(region, allocator->m_region_size);
+        return 0;
+    }
+    memset(allocator->m_is_free, 1, count);
+    // The first buffer on top, so a lightly used pool only touches the start of the region.
+    for (u32 i = 0; i < count; ++i)
+        allocator->m_free[i] = count - 1 - i;
+    allocator->m_free_count = count;
+    allocator->m_region     = region;
+    return 1;
+}
+
+void iopool_destroy(allocator_iopool_t* allocator) {
+    munmap(allocator->m_region, allocator->m_region_size);
+    nax_free(allocator_malloc, (byte_t*) allocator->m_free);
+    nax_free(allocator_malloc, allocator->m_is_free);
+    memset(allocator, 0, sizeof(*allocator));
+}
+
+
+void iopool_lock(allocator_iopool_t* allocator) {
+    while (__atomic_exchange_n(&allocator->m_lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+void iopool_unlock(allocator_iopool_t* allocator) {
+    __atomic_store_n(&allocator->m_lock, 0, __ATOMIC_RELEASE);
+}
+
+
+int iopool_owns(allocator_iopool_t* allocator, const byte_t* memory) {
+    return allocator->m_region <= memory && memory < allocator->m_region + allocator->m_region_size;
+}
+
+// The buffer's index in the region, for APIs that refer to registered buffers by index.
+u32 iopool_index(allocator_iopool_t* allocator, const byte_t* memory) {
+    ASSERTF(iopool_owns(allocator, memory), "Memory is not in the pool!");
+    size_t offset = (size_t) (memory - allocator->m_region);
+    ASSERTF(offset % allocator->m_buffer_size == 0, "Memory is not the start of a buffer!");
+    return (u32) (offset / allocator->m_buffer_size);
+}
+
+byte_t* iopool_buffer(allocator_iopool_t* allocator, u32 index) {
+    ASSERTF(index < allocator->m_count, "Buffer %u is not in the pool!", index);
+    return allocator->m_region + (size_t) index * allocator->m_buffer_size;
+}
+
+// Records that buffer `index` was handed out or freed, whether through the pool or a cache. Atomic,
+// as caches on different threads mark buffers whose flags share a cache line.
+void iopool_mark_free(allocator_iopool_t* allocator, u32 index, u8 is_free) {
+    u8 was_free = __atomic_exchange_n(&allocator->m_is_free[index], is_free, __ATOMIC_RELAXED);
+    ASSERTF(was_free != is_free, "Buffer %u was %s twice!", index, is_free ? "freed" : "handed out");
+}
+
+
+// Moves up to `count` buffers from the top of the pool's stack. Returns how many were moved.
+u32 iopool_take(allocator_iopool_t* allocator, u32* buffers, u32 count) {
+    iopool_lock(allocator);
+    if (count > allocator->m_free_count)
+        count = allocator->m_free_count;
+    for (u32 i = 0; i < count; ++i)
+        buffers[count - 1 - i] = allocator->m_free[--allocator->m_free_count];
+    iopool_unlock(allocator);
+    return count;
+}
+
+void iopool_give(allocator_iopool_t* allocator, const u32* buffers, u32 count) {
+    iopool_lock(allocator);
+    for (u32 i = 0; i < count; ++i) {
+        ASSERTF(allocator->m_free_count < allocator->m_count, "More buffers given back than the pool has, a double free?");
+        allocator->m_free[allocator->m_free_count++] = buffers[i];
+    }
+    iopool_unlock(allocator);
+}
+
+
+allocation_result_t iopool_allocate(allocator_iopool_t* allocator, word_t size, word_t alignment) {
+    if ((size_t) size > allocator->m_buffer_size || (size_t) alignment > IOPOOL_ALIGNMENT) {
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+    u32 index = 0;
+    if (iopool_take(allocator, &index, 1) == 0) {
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+    iopool_mark_free(allocator, index, 0);
+    return make_allocation_result(iopool_buffer(allocator, index));
+}
+
+allocation_result_t iopool_free(allocator_iopool_t* allocator, byte_t* memory) {
+    if (memory == 0) {
+        return make_free_status(FREE_STATUS_SUCCEEDED);
+    }
+    if (!iopool_owns(allocator, memory)) {
+        return make_free_status(FREE_STATUS_CALLED_ON_NON_OWNED_MEMORY);
+    }
+    u32 index = iopool_index(allocator, memory);
+    iopool_mark_free(allocator, index, 1);
+    iopool_give(allocator, &index, 1);
+    return make_free_status(FREE_STATUS_SUCCEEDED);
+}
+
+// Only safe when no buffer is in use or held by a cache.
+allocation_result_t iopool_free_all(allocator_iopool_t* allocator) {
+    iopool_lock(allocator);
+    for (u32 i = 0; i < allocator->m_count; ++i)
+        allocator->m_free[i] = allocator->m_count - 1 - i;
+    allocator->m_free_count = allocator->m_count;
+    memset(allocator->m_is_free, 1, allocator->m_count);
+    iopool_unlock(allocator);
+    return make_free_status(FREE_STATUS_SUCCEEDED);
+}
+
+
+allocation_result_t allocator_iopool_proc(void* allocator_raw, allocation_arguments_t arguments) {
+    allocator_iopool_t* allocator = (allocator_iopool_t*) allocator_raw;
+    switch (arguments.mode) {
+        case ALLOCATE:          return iopool_allocate(allocator, arguments.allocate.size, 1);
+        case ALLOCATE_ALIGNED:  return iopool_allocate(allocator, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
+        case FREE:              return iopool_free(allocator, arguments.free.memory);
+        case FREE_ALL:          return iopool_free_all(allocator);
+        case QUERY_USED:        return make_query_result((size_t) (allocator->m_count - __atomic_load_n(&allocator->m_free_count, __ATOMIC_RELAXED)) * allocator->m_buffer_size);
+        case QUERY_OWNS:        return make_query_result((size_t) iopool_owns(allocator, arguments.owns.memory));
+        case QUERY_CAPACITY:    return make_query_result(allocator->m_region_size);
+        case QUERY_ALIGNMENT:   return make_query_result(IOPOOL_ALIGNMENT);
+        case QUERY_GOOD_SIZE:   return make_query_result(allocator->m_buffer_size);
+        case QUERY_ALLOCATION_SIZE:
+            return make_query_result(((size_t) arguments.allocate_aligned.size <= allocator->m_buffer_size) ? allocator->m_buffer_size : 0);
+        case QUERY_USABLE_SIZE:
+            return make_query_result(iopool_owns(allocator, arguments.usable_size.memory) ? allocator->m_buffer_size : 0);
+
+        // @NOTE: Unsupported, a buffer can't grow past its size.
+        case ALLOCATE_ALL:
+        case RESIZE:
+            return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
+    }
+}
+
+
+
+/* ---- PER-THREAD CACHES ---- */
+iopool_cache_t iopool_cache_init(allocator_iopool_t* pool) {
+    return (iopool_cache_t) { .pool=pool, .m_count=0 };
+}
+
+// Gives every cached buffer back to the pool, e.g. before the thread exits.
+void iopool_cache_flush(iopool_cache_t* cache) {
+    iopool_give(cache->pool, cache->m_buffers, cache->m_count);
+    cache->m_count = 0;
+}
+
+
+allocation_result_t iopool_cache_allocate(iopool_cache_t* cache, word_t size, word_t alignment) {
+    allocator_iopool_t* pool = cache->pool;
+    if ((size_t) size > pool->m_buffer_size || (size_t) alignment > IOPOOL_ALIGNMENT) {
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+    if (cache->m_count == 0) {
+        cache->m_count = iopool_take(pool, cache->m_buffers, IOPOOL_CACHE_CAPACITY / 2);
+        if (cache->m_count == 0)
+            return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+    u32 index = cache->m_buffers[--cache->m_count];
+    iopool_mark_free(pool, index, 0);
+    return make_allocation_result(iopool_buffer(pool, index));
+}
+
+allocation_result_t iopool_cache_free(iopool_cache_t* cache, byte_t* memory) {
+    if (memory == 0) {
+        return make_free_status(FREE_STATUS_SUCCEEDED);
+    }
+    if (!iopool_owns(cache->pool, memory)) {
+        return make_free_status(FREE_STATUS_CALLED_ON_NON_OWNED_MEMORY);
+    }
+    u32 index = iopool_index(cache->pool, memory);
+    iopool_mark_free(cache->pool, index, 1);
+    if (cache->m_count == IOPOOL_CACHE_CAPACITY) {
+        // The bottom half is the coldest, so that's what goes back.
+        iopool_give(cache->pool, cache->m_buffers, IOPOOL_CACHE_CAPACITY / 2);
+        memmove(cache->m_buffers, cache->m_buffers + IOPOOL_CACHE_CAPACITY / 2, (IOPOOL_CACHE_CAPACITY / 2) * sizeof(u32));
+        cache->m_count = IOPOOL_CACHE_CAPACITY / 2;
+    }
+    cache->m_buffers[cache->m_count++] = index;
+    return make_free_status(FREE_STATUS_SUCCEEDED);
+}
+
+
+allocation_result_t allocator_iopool_cache_proc(void* allocator_raw, allocation_arguments_t arguments) {
+    iopool_cache_t* cache = (iopool_cache_t*) allocator_raw;
+    switch (arguments.mode) {
+        case ALLOCATE:          return iopool_cache_allocate(cache, arguments.allocate.size, 1);
+        case ALLOCATE_ALIGNED:  return iopool_cache_allocate(cache, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
+        case FREE:              return iopool_cache_free(cache, arguments.free.memory);
+
+        case FREE_ALL:
+            cache->m_count = 0;
+            return allocator_iopool_proc(cache->pool, arguments);
+
+        case ALLOCATE_ALL:
+        case RESIZE:
+        case QUERY_USED:
+        case QUERY_OWNS:
+        case QUERY_CAPACITY:
+        case QUERY_ALIGNMENT:
+        case QUERY_GOOD_SIZE:
+        case QUERY_ALLOCATION_SIZE:
+        case QUERY_USABLE_SIZE:
+            return allocator_iopool_proc(cache->pool, arguments);
+    }
+}
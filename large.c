@@ -0,0 +1,269 @@
+/* Maps every allocation directly from the OS, for allocations too large for the other strategies.
+ *
+ * RESIZE uses mremap, so growing a buffer of several megabytes moves page table entries
+ * instead of copying the data, and FREE unmaps right away so the memory leaves the process.
+ * Every allocation is the start of its mapping, so it is page-aligned and a page-sized request
+ * takes exactly one page. The size of each mapping is kept out of line, in a small hash table
+ * found by the mapping's address. Meant to be the secondary of a segregator.
+ */
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define LARGE_MINIMUM_ALIGNMENT 16
+#define LARGE_TABLE_MINIMUM     64              // Slots in the table when it's first needed.
+#define LARGE_TOMBSTONE         ((byte_t*) 1)   // A slot whose mapping was freed, so lookups probe past it.
+
+
+typedef struct {
+    byte_t* memory;         // 0 if the slot was never used.
+    size_t  mapping_size;
+} large_entry_t;
+
+typedef struct {
+    size_t         m_page_size;
+    size_t         m_used;          // Bytes mapped for live allocations, including page rounding.
+    size_t         m_count;
+    large_entry_t* m_entries;       // Open addressing with linear probing.
+    size_t         m_capacity;      // Slots, a power of two.
+    size_t         m_occupied;      // Slots that are live or tombstones.
+    u32            m_lock;
+} allocator_large_t;
+
+
+allocator_large_t large_init(void) {
+    return (allocator_large_t) {
+            .m_page_size = (size_t) sysconf(_SC_PAGESIZE),
+            .m_used      = 0,
+            .m_count     = 0,
+            .m_entries   = 0,
+            .m_capacity  = 0,
+            .m_occupied  = 0,
+            .m_lock      = 0,
+    };
+}
+
+// Frees the table. Mappings that are still live stay mapped.
+void large_destroy(allocator_large_t* allocator) {
+    if (allocator->m_entries != 0)
+        nax_free(allocator_malloc, (byte_t*) allocator->m_entries);
+    memset(allocator, 0, sizeof(*allocator));
+}
+
+
+void large_lock(allocator_large_t* allocator) {
+    while (__atomic_exchange_n(&allocator->m_lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+void large_unlock(allocator_large_t* allocator) {
+    __atomic_store_n(&allocator->m_lock, 0, __ATOMIC_RELEASE);
+}
+
+
+// The first slot to probe for a mapping. Mappings are page-aligned, so the page number is hashed.
+size_t large_slot(allocator_large_t* allocator, const byte_t* memory) {
+    u64 hash = (u64) ((size_t) memory / allocator->m_page_size) * 0x9E3779B97F4A7C15ull;
+    return (size_t) (hash >> 32) & (allocator->m_capacity - 1);
+}
+
+// The entry of a live mapping, or 0. Must hold the lock.
+large_entry_t* large_find(allocator_large_t* allocator, const byte_t* memory) {
+    if (allocator->m_capacity == 0 || memory == 0 || memory == LARGE_TOMBSTONE)
+        return 0;
+    for (size_t slot = large_slot(allocator, memory);; slot = (slot + 1) & (allocator->m_capacity - 1)) {
+        large_entry_t* entry = &allocator->m_entries[slot];
+        if (entry->memory == memory)
+            return entry;
+        if (entry->memory == 0)
+            return 0;
+    }
+}
+
+// Adds a mapping, assuming there is room. Must hold the lock.
+void large_insert(allocator_large_t* allocator, byte_t* memory, size_t mapping_size) {
+    size_t slot = large_slot(allocator, memory);
+    while (allocator->m_entries[slot].memory != 0 && allocator->m_entries[slot].memory != LARGE_TOMBSTONE)
+        slot = (slot + 1) & (allocator->m_capacity - 1);
+    if (allocator->m_entries[slot].memory == 0)
+        allocator->m_occupied += 1;
+    allocator->m_entries[slot] = (large_entry_t) { .memory=memory, .mapping_size=mapping_size };
+}
+
+// Makes room for one more mapping, keeping the table at most half occupied. Rebuilding it also
+// clears the tombstones. Returns 0 if the new table couldn't be allocated. Must hold the lock.
+int large_reserve(allocator_large_t* allocator) {
+    if ((allocator->m_occupied + 1) * 2 <= allocator->m_capacity)
+        return 1;
+
+    size_t live     = __atomic_load_n(&allocator->m_count, __ATOMIC_RELAXED);
+    size_t capacity = LARGE_TABLE_MINIMUM;
+    while (capacity < (live + 1) * 4)
+        capacity *= 2;
+
+    large_entry_t* entries = (large_entry_t*) nax_allocate_type(allocator_malloc, large_entry_t, capacity);
+    if (!allocation_succeeded((byte_t*) entries))
+        return 0;
+    memset(entries, 0, capacity * sizeof(large_entry_t));
+
+    large_entry_t* old_entries  = allocator->m_entries;
+    size_t         old_capacity = allocator->m_capacity;
+    allocator->m_entries  = entries;
+    allocator->m_capacity = capacity;
+    allocator->m_occupied = 0;
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_entries[i].memory != 0 && old_entries[i].memory != LARGE_TOMBSTONE)
+            large_insert(allocator, old_entries[i].memory, old_entries[i].mapping_size);
+    }
+    if (old_entries != 0)
+        nax_free(allocator_malloc, (byte_t*) old_entries);
+    return 1;
+}
+
+
+allocation_result_t large_allocate_aligned(allocator_large_t* allocator, word_t size, word_t alignment) {
+    if ((size_t) alignment > allocator->m_page_size)
+        return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
+
+    size_t mapping_size = align_address((size > 0) ? (size_t) size : 1, allocator->m_page_size);
+    byte_t* mapping = (byte_t*) mmap(0, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+
+    large_lock(allocator);
+    int reserved = large_reserve(allocator);
+    if (reserved)
+        large_insert(allocator, mapping, mapping_size);
+    large_unlock(allocator);
+    if (!reserved) {
+        munmap(mapping, mapping_size);
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+
+    __atomic_add_fetch(&allocator->m_used,  mapping_size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocator->m_count, 1,            __ATOMIC_RELAXED);
+    return make_allocation_result(mapping);
+}
+
+
+// Holds the lock across mremap, so the table always has room for the mapping wherever it lands.
+allocation_result_t large_resize(allocator_large_t* allocator, byte_t* memory, word_t old_size, word_t new_size) {
+    if (memory == 0) {
+        return large_allocate_aligned(allocator, new_size, LARGE_MINIMUM_ALIGNMENT);
+    }
+
+    large_lock(allocator);
+    large_entry_t* entry = large_find(allocator, memory);
+    ASSERTF(entry != 0, "Memory wasn't allocated by a large allocator!");
+    size_t old_mapping_size = entry->mapping_size;
+    size_t new_mapping_size = align_address((new_size > 0) ? (size_t) new_size : 1, allocator->m_page_size);
+    if (new_mapping_size == old_mapping_size) {
+        large_unlock(allocator);
+        return make_allocation_result(memory);
+    }
+    if (!large_reserve(allocator)) {
+        large_unlock(allocator);
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+
+#ifdef MREMAP_MAYMOVE
+    byte_t* new_memory = (byte_t*) mremap(memory, old_mapping_size, new_mapping_size, MREMAP_MAYMOVE);
+    if (new_memory == MAP_FAILED) {
+        large_unlock(allocator);
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+#else
+    byte_t* new_memory = (byte_t*) mmap(0, new_mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (new_memory == MAP_FAILED) {
+        large_unlock(allocator);
+        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+    }
+    size_t copy_size = (old_mapping_size < new_mapping_size) ? old_mapping_size : new_mapping_size;
+    memcpy(new_memory, memory, copy_size);
+    munmap(memory, old_mapping_size);
+#endif
+
+    // The entry was found before large_reserve may have rebuilt the table.
+    large_find(allocator, memory)->memory = LARGE_TOMBSTONE;
+    large_insert(allocator, new_memory, new_mapping_size);
+    large_unlock(allocator);
+
+    __atomic_add_fetch(&allocator->m_used, new_mapping_size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&allocator->m_used, old_mapping_size, __ATOMIC_RELAXED);
+    return make_allocation_result(new_memory);
+}
+
+
+allocation_result_t large_free(allocator_large_t* allocator, byte_t* memory) {
+    if (memory == 0) {
+        return make_free_status(FREE_STATUS_SUCCEEDED);
+    }
+
+    large_lock(allocator);
+    large_entry_t* entry = large_find(allocator, memory);
+    size_t mapping_size = (entry != 0) ? entry->mapping_size : 0;
+    if (entry != 0)
+        entry->memory = LARGE_TOMBSTONE;
+    large_unlock(allocator);
+    if (entry == 0) {
+        return make_free_status(FREE_STATUS_CALLED_ON_NON_OWNED_MEMORY);
+    }
+
+    munmap(memory, mapping_size);
+    __atomic_sub_fetch(&allocator->m_used,  mapping_size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&allocator->m_count, 1,            __ATOMIC_RELAXED);
+    return make_free_status(FREE_STATUS_SUCCEEDED);
+}
+
+
+int large_owns(allocator_large_t* allocator, const byte_t* memory) {
+    large_lock(allocator);
+    int owns = large_find(allocator, memory) != 0;
+    large_unlock(allocator);
+    return owns;
+}
+
+
+// The rest of the last page can be used too.
+allocation_result_t large_allocation_size(allocator_large_t* allocator, word_t size, word_t alignment) {
+    if ((size_t) alignment > allocator->m_page_size)
+        return make_query_result(0);
+    return make_query_result(align_address((size > 0) ? (size_t) size : 1, allocator->m_page_size));
+}
+
+allocation_result_t large_usable_size(allocator_large_t* allocator, const byte_t* memory) {
+    if (memory == 0) {
+        return make_query_result(0);
+    }
+    large_lock(allocator);
+    large_entry_t* entry = large_find(allocator, memory);
+    size_t mapping_size = (entry != 0) ? entry->mapping_size : 0;
+    large_unlock(allocator);
+    return make_query_result(mapping_size);
+}
+
+
+allocation_result_t allocator_large_proc(void* allocator_raw, allocation_arguments_t arguments) {
+    allocator_large_t* allocator = (allocator_large_t*) allocator_raw;
+    switch (arguments.mode) {
+        case ALLOCATE:          return large_allocate_aligned(allocator, arguments.allocate.size, LARGE_MINIMUM_ALIGNMENT);
+        case ALLOCATE_ALIGNED:  return large_allocate_aligned(allocator, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
+        case RESIZE:            return large_resize(allocator, arguments.resize.memory, arguments.resize.old_size, arguments.resize.new_size);
+        case FREE:              return large_free(allocator, arguments.free.memory);
+        case QUERY_USED:        return make_query_result(__atomic_load_n(&allocator->m_used, __ATOMIC_RELAXED));
+        case QUERY_OWNS:        return make_query_result((size_t) large_owns(allocator, arguments.owns.memory));
+        case QUERY_ALIGNMENT:   return make_query_result(allocator->m_page_size);
+        case QUERY_GOOD_SIZE:   return make_query_result(allocator->m_page_size);
+        case QUERY_ALLOCATION_SIZE: return large_allocation_size(allocator, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
+        case QUERY_USABLE_SIZE:     return large_usable_size(allocator, arguments.usable_size.memory);
+
+        // @NOTE: Unsupported.
+        case ALLOCATE_ALL:
+        case FREE_ALL:
+            return make_allocation_error(ALLOCATION_STATUS_UNSUPPORTED_OPERATION);
+
+        case QUERY_CAPACITY:
+            return make_query_result(ALLOCATION_QUERY_UNSUPPORTED);
+    }
+}
@@ -82,5 +82,133 @@ int main(__attribute__((unused)) int argc, __attribute__((unused)) const char* a
         nax_free_all(fallback_allocator);
     }
 
+
+    printf("---- Usable size ----\n");
+    {
+        allocator_large_t large_alloc = large_init();
+        allocator_t large = { allocator_large_proc, &large_alloc };
+        allocator_freelist_t pool = freelist_init(ALLOCATE_STACK(16 * 128), 128, 16);
+        allocator_segregator_t segregator_alloc = { { allocator_freelist_proc, &pool }, large, 128, 0 };
+        allocator_t segregator = { allocator_segregator_proc, &segregator_alloc };
+
+        // Small requests get a whole block, large ones the rest of their last page.
+        printf("%zu %zu\n", nax_query_allocation_size(segregator, 20, 8), nax_query_allocation_size(segregator, 5000, 8));
+        byte_t* memory = nax_allocate(segregator, 5000);
+        printf("%zu\n", nax_query_usable_size(segregator, memory));
+        nax_free(segregator, memory);
+
+        // Every large allocation starts a page, so a page-aligned one costs nothing extra.
+        byte_t* page = nax_allocate_aligned(large, 100, large_alloc.m_page_size);
+        printf("%zu %zu\n", (size_t) page & (large_alloc.m_page_size - 1), nax_query_usable_size(large, page));
+        nax_free(large, page);
+        large_destroy(&large_alloc);
+    }
+
+
+    printf("---- Relative pointers ----\n");
+    {
+        typedef struct { u32 value; stack_relative_t next; } node_t;
+
+        allocator_stack_t arena = allocator_stack_init(ALLOCATE_STACK(256), 256);
+        stack_relative_t head = 0;
+        for (u32 i = 1; i <= 3; ++i) {
+            stack_relative_t offset = stack_allocate_relative_type(&arena, node_t, 1);
+            ASSERT(offset != 0);
+            *stack_pointer(&arena, node_t, offset) = (node_t) { .value=i, .next=head };
+            head = offset;
+        }
+        for (node_t* node = stack_pointer(&arena, node_t, head); node != 0; node = stack_pointer(&arena, node_t, node->next)) {
+            printf("%u\n", node->value);
+        }
+
+        typedef struct { u32 value; freelist_relative_t next; } pool_node_t;
+
+        allocator_freelist_t pool = freelist_init(ALLOCATE_STACK(8 * sizeof(pool_node_t)), sizeof(pool_node_t), 8);
+        freelist_relative_t a = freelist_allocate_relative(&pool);
+        freelist_relative_t b = freelist_allocate_relative(&pool);
+        *freelist_pointer(&pool, pool_node_t, b) = (pool_node_t) { .value=20, .next=0 };
+        *freelist_pointer(&pool, pool_node_t, a) = (pool_node_t) { .value=10, .next=b };
+        printf("%u %u\n", freelist_pointer(&pool, pool_node_t, a)->value, freelist_pointer(&pool, pool_node_t, freelist_pointer(&pool, pool_node_t, a)->next)->value);
+        freelist_free_relative(&pool, b);
+        freelist_free_relative(&pool, a);
+        printf("%zu\n", freelist_used(&pool));
+    }
+
+
+    printf("---- Table and interner ----\n");
+    {
+        allocator_stack_t arena_alloc = allocator_stack_init(ALLOCATE_STACK(4096), 4096);
+        allocator_t arena = { allocator_stack_proc, &arena_alloc };
+
+        // Everything lives in the arena, so one FREE_ALL and a reset drop it all.
+        interner_t interner = interner_init(arena, 1);
+        table_t counts = table_init_type(arena, u32, u32, 1);
+        const char* words[] = { "GET", "Host", "Accept", "Host", "GET" };
+        for (u32 i = 0; i < sizeof(words) / sizeof(words[0]); ++i) {
+            const char* word = interner_intern_cstring(&interner, words[i]);
+            u32 index = (u32) interner_find(&interner, word, (u32) strlen(word));
+            u32* count = (u32*) table_find(&counts, &index);
+            u32 next = (count != 0) ? *count + 1 : 1;
+            table_insert(&counts, &index, &next);
+        }
+        for (u32 index = 0; index < interner_count(&interner); ++index) {
+            printf("%u %u\n", index, *(u32*) table_find(&counts, &index));
+        }
+        nax_free_all(arena);
+        interner_reset(&interner);
+        table_reset(&counts);
+        printf("%zu %u\n", nax_query_used(arena), interner_count(&interner));
+    }
+
+
+    printf("---- Cache lines ----\n");
+    {
+        allocator_stack_t stack_alloc = allocator_stack_init(ALLOCATE_STACK(1024), 1024);
+        allocator_t stack = { allocator_stack_proc, &stack_alloc };
+        allocator_exclusive_t exclusive_alloc = exclusive_init(stack, CACHE_LINE_SIZE);
+        allocator_t exclusive = { allocator_exclusive_proc, &exclusive_alloc };
+
+        // Two counters straight from the stack share a line, through the compositor they don't.
+        u64* a = (u64*) nax_allocate(stack, sizeof(u64));
+        u64* b = (u64*) nax_allocate(stack, sizeof(u64));
+        u64* c = (u64*) nax_allocate(exclusive, sizeof(u64));
+        u64* d = (u64*) nax_allocate(exclusive, sizeof(u64));
+        printf("%td %td %zu\n", (byte_t*) b - (byte_t*) a, (byte_t*) d - (byte_t*) c, nax_query_alignment(exclusive));
+
+        // Pools that start on the same page offset, colored one line apart.
+        byte_t* pages = (byte_t*) align_address((size_t) ALLOCATE_STACK(3 * 4096), 4096);
+        allocator_freelist_t first  = freelist_init_colored(pages, 4096, 96, 0);
+        allocator_freelist_t second = freelist_init_colored(pages + 4096, 4096, 96, 1);
+        allocator_t second_allocator = { allocator_freelist_proc, &second };
+        printf("%zu %zu %zu\n", (size_t) first.m_memory & 4095, (size_t) second.m_memory & 4095, nax_query_alignment(second_allocator));
+    }
+
+
+    printf("---- Persistent allocator ----\n");
+    {
+        typedef struct { u32 value; relative_t next; } node_t;
+        const char* path = "persistent_example.arena";
+        unlink(path);
+
+        allocator_persistent_t persistent;
+        ASSERT(persistent_open(&persistent, path, 4096) == PERSISTENT_STATUS_CREATED);
+        allocator_t persistent_allocator = { allocator_persistent_proc, &persistent };
+
+        node_t* first  = (node_t*) nax_allocate_type(persistent_allocator, node_t, 1);
+        node_t* second = (node_t*) nax_allocate_type(persistent_allocator, node_t, 1);
+        *second = (node_t) { .value=2, .next=0 };
+        *first  = (node_t) { .value=1, .next=persistent_to_relative(&persistent, second) };
+        persistent_set_root(&persistent, first);
+        persistent_close(&persistent);
+
+        ASSERT(persistent_open(&persistent, path, 4096) == PERSISTENT_STATUS_OPENED);
+        for (node_t* node = (node_t*) persistent_root(&persistent); node != 0; node = persistent_pointer(&persistent, node_t, node->next)) {
+            printf("%u\n", node->value);
+        }
+        printf("%zu\n", nax_query_used(persistent_allocator));
+        persistent_close(&persistent);
+        unlink(path);
+    }
+
     return 0;
 }
@@ -0,0 +1,169 @@
+/* A stack allocator whose memory is a memory-mapped file.
+ *
+ * The file starts with a header that records the stack's `m_pointer`, so reopening the file
+ * gives back an arena where everything allocated before is still in place and new allocations
+ * continue after it. The mapping may land on a different address each time, so data stored
+ * in the arena must refer to other data in it through `relative_t` offsets and never through
+ * raw pointers.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PERSISTENT_MAGIC        0x4E41584146494C45ULL  // "NAXAFILE"
+#define PERSISTENT_VERSION      1
+#define PERSISTENT_HEADER_SIZE  64
+
+
+typedef struct {
+    u64 magic;
+    u32 version;
+    u32 header_size;
+    u32 capacity;
+    u32 pointer;    // The stack's `m_pointer` when it was last changed.
+    u32 root;       // A `relative_t` to whatever the user wants to find again after reopening.
+} persistent_header_t;
+
+// An offset from the start of the mapping. As the header is at offset 0, 0 is never a valid
+// allocation and is used as null.
+typedef u32 relative_t;
+
+
+typedef struct {
+    allocator_stack_t    m_stack;
+    persistent_header_t* m_header;
+    byte_t*              m_mapping;
+    size_t               m_mapping_size;
+    int                  m_file;
+} allocator_persistent_t;
+
+
+typedef enum {
+    PERSISTENT_STATUS_CREATED = 0,   // A new, empty arena was created.
+    PERSISTENT_STATUS_OPENED,        // An existing arena was mapped and can be used immediately.
+    PERSISTENT_STATUS_FAILED,        // The file couldn't be opened, resized or mapped.
+    PERSISTENT_STATUS_INCOMPATIBLE,  // The file exists but isn't an arena of this version.
+} persistent_status_t;
+
+
+// Opens the arena at `path`, creating it with room for `capacity` bytes if it doesn't exist.
+// An existing arena keeps the capacity it was created with.
+persistent_status_t persistent_open(allocator_persistent_t* allocator, const char* path, u32 capacity) {
+    int file = open(path, O_RDWR | O_CREAT, 0644);
+    if (file < 0) {
+        return PERSISTENT_STATUS_FAILED;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0) {
+        close(file);
+        return PERSISTENT_STATUS_FAILED;
+    }
+
+    int is_new = info.st_size == 0;
+    persistent_header_t header = { 0 };
+    if (is_new) {
+        header = (persistent_header_t) {
+                .magic       = PERSISTENT_MAGIC,
+                .version     = PERSISTENT_VERSION,
+                .header_size = PERSISTENT_HEADER_SIZE,
+                .capacity    = capacity,
+                .pointer     = 0,
+                .root        = 0,
+        };
+        if (ftruncate(file, (off_t) PERSISTENT_HEADER_SIZE + capacity) != 0) {
+            close(file);
+            return PERSISTENT_STATUS_FAILED;
+        }
+    } else {
+        if ((size_t) info.st_size < PERSISTENT_HEADER_SIZE || pread(file, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+            close(file);
+            return PERSISTENT_STATUS_INCOMPATIBLE;
+        }
+        if (header.magic != PERSISTENT_MAGIC || header.version != PERSISTENT_VERSION || header.header_size != PERSISTENT_HEADER_SIZE ||
+            (size_t) info.st_size < (size_t) PERSISTENT_HEADER_SIZE + header.capacity || header.pointer > header.capacity) {
+            close(file);
+            return PERSISTENT_STATUS_INCOMPATIBLE;
+        }
+    }
+
+    size_t  mapping_size = (size_t) PERSISTENT_HEADER_SIZE + header.capacity;
+    byte_t* mapping      = (byte_t*) mmap(0, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (mapping == MAP_FAILED) {
+        close(file);
+        return PERSISTENT_STATUS_FAILED;
+    }
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcast-align"
+    *allocator = (allocator_persistent_t) {
+            .m_stack        = allocator_stack_init(mapping + PERSISTENT_HEADER_SIZE, header.capacity),
+            .m_header       = (persistent_header_t*) mapping,
+            .m_mapping      = mapping,
+            .m_mapping_size = mapping_size,
+            .m_file         = file,
+    };
+#pragma clang diagnostic pop
+
+    if (is_new) {
+        *allocator->m_header = header;
+        return PERSISTENT_STATUS_CREATED;
+    } else {
+        allocator->m_stack.m_pointer = header.pointer;
+        allocator->m_stack.m_peak    = header.pointer;
+        return PERSISTENT_STATUS_OPENED;
+    }
+}
+
+
+// Flushes the arena to the file. Not needed for correctness on close, but limits what a crash can lose.
+int persistent_sync(allocator_persistent_t* allocator) {
+    allocator->m_header->pointer = allocator->m_stack.m_pointer;
+    return msync(allocator->m_mapping, allocator->m_mapping_size, MS_SYNC) == 0;
+}
+
+
+void persistent_close(allocator_persistent_t* allocator) {
+    allocator->m_header->pointer = allocator->m_stack.m_pointer;
+    munmap(allocator->m_mapping, allocator->m_mapping_size);
+    close(allocator->m_file);
+    *allocator = (allocator_persistent_t) { 0 };
+}
+
+
+relative_t persistent_to_relative(allocator_persistent_t* allocator, const void* memory) {
+    if (memory == 0) {
+        return 0;
+    }
+    ASSERTF(allocator->m_mapping + PERSISTENT_HEADER_SIZE <= (const byte_t*) memory && (const byte_t*) memory <= allocator->m_mapping + allocator->m_mapping_size,
+            "Memory is not in the arena!");
+    return (relative_t) ((const byte_t*) memory - allocator->m_mapping);
+}
+
+void* persistent_from_relative(allocator_persistent_t* allocator, relative_t offset) {
+    if (offset == 0) {
+        return 0;
+    }
+    ASSERTF(offset >= PERSISTENT_HEADER_SIZE && offset <= allocator->m_mapping_size, "Offset %u is not in the arena!", offset);
+    return allocator->m_mapping + offset;
+}
+
+#define persistent_pointer(allocator, type_, offset) ((type_*) persistent_from_relative(allocator, offset))
+
+
+void persistent_set_root(allocator_persistent_t* allocator, const void* memory) {
+    allocator->m_header->root = persistent_to_relative(allocator, memory);
+}
+
+void* persistent_root(allocator_persistent_t* allocator) {
+    return persistent_from_relative(allocator, allocator->m_header->root);
+}
+
+
+allocation_result_t allocator_persistent_proc(void* allocator_raw, allocation_arguments_t arguments) {
+    allocator_persistent_t* allocator = (allocator_persistent_t*) allocator_raw;
+    allocation_result_t result = allocator_stack_proc(&allocator->m_stack, arguments);
+    allocator->m_header->pointer = allocator->m_stack.m_pointer;
+    return result;
+}
@@ -1,5 +1,10 @@
 #pragma once
 
+// For mremap and MAP_ANONYMOUS, which must be defined before any system header.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -0,0 +1,332 @@
+/* Samples allocations and keeps statistics per call site, cheap enough to leave on.
+ *
+ * Every thread counts down a random number of bytes, averaging `sample_period`, and the
+ * allocation that crosses zero is sampled together with the location the `nax_*` macros
+ * captured. A sample stands in for roughly `sample_period` bytes (or its own size if larger),
+ * so the per-site numbers are estimates of the totals. Unsampled allocations cost a
+ * thread-local subtraction and unsampled frees a probe in the table of live samples, which is
+ * done without the lock and guarded by a sequence number against entries being moved.
+ *
+ * It can sit anywhere in a composition; the location is the caller's even when the request
+ * reaches it through a segregator, fallback or any other compositor.
+ */
+#include <sched.h>
+#include <time.h>
+
+#define PROFILER_MAX_SITES      1024    // Must be a power of two.
+#define PROFILER_MAX_SAMPLES    8192    // Must be a power of two.
+
+
+typedef struct {
+    const char* file;
+    const char* function;
+    int         line;
+    u64         allocated_bytes;    // Estimated totals since the start.
+    u64         allocated_count;
+    i64         live_bytes;         // Estimated for the allocations that haven't been freed.
+    i64         live_count;
+    u64         reported_bytes;     // `allocated_bytes` at the previous report, for the rate.
+} profiler_site_t;
+
+typedef struct {
+    const byte_t* memory;
+    u32           site;
+    u64           bytes;
+    u64           count;
+} profiler_sample_t;
+
+typedef struct {
+    allocator_t child;
+    u64         sample_period;
+    u32         m_lock;
+    u32         m_version;          // Odd while entries in the sample table are being moved or cleared.
+    u32         m_samples_live;
+    u64         m_dropped;          // Samples not recorded as a table was full.
+    f64         m_reported_time;
+    profiler_site_t   m_sites[PROFILER_MAX_SITES];
+    profiler_sample_t m_samples[PROFILER_MAX_SAMPLES];
+} allocator_profiler_t;
+
+
+static __thread i64 profiler_bytes_until_sample = 0;
+static __thread u64 profiler_random_state       = 0;
+
+
+f64 profiler_now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (f64) time.tv_sec + (f64) time.tv_nsec * 1e-9;
+}
+
+
+void profiler_init(allocator_profiler_t* allocator, allocator_t child, u64 sample_period) {
+    ASSERTF(sample_period > 0, "Sample period must be positive!");
+    memset(allocator, 0, sizeof(*allocator));
+    allocator->child           = child;
+    allocator->sample_period   = sample_period;
+    allocator->m_reported_time = profiler_now();
+}
+
+
+void profiler_lock(allocator_profiler_t* allocator) {
+    while (__atomic_exchange_n(&allocator->m_lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+void profiler_unlock(allocator_profiler_t* allocator) {
+    __atomic_store_n(&allocator->m_lock, 0, __ATOMIC_RELEASE);
+}
+
+
+u64 profiler_hash(const void* pointer, u64 extra) {
+    u64 hash = ((u64) (size_t) pointer ^ extra) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+}
+
+
+// Uniform in [0, 2 * period), so the mean is the period without sampling in lockstep with the program.
+i64 profiler_next_interval(allocator_profiler_t* allocator) {
+    if (profiler_random_state == 0)
+        profiler_random_state = profiler_hash(&profiler_random_state, (u64) (size_t) allocator) | 1;
+    profiler_random_state ^= profiler_random_state << 13;
+    profiler_random_state ^= profiler_random_state >> 7;
+    profiler_random_state ^= profiler_random_state << 17;
+    return (i64) (profiler_random_state % (2 * allocator->sample_period)) + 1;
+}
+
+
+profiler_site_t* profiler_find_site(allocator_profiler_t* allocator, source_location_t location, u32* index) {
+    u32 mask = PROFILER_MAX_SITES - 1;
+    for (u32 i = (u32) profiler_hash(location.file, (u64) location.line) & mask, probes = 0; probes < PROFILER_MAX_SITES; i = (i + 1) & mask, ++probes) {
+        profiler_site_t* site = &allocator->m_sites[i];
+        if (site->file == 0) {
+            site->file     = location.file;
+            site->function = location.function;
+            site->line     = location.line;
+        }
+        if (site->file == location.file && site->line == location.line) {
+            *index = i;
+            return site;
+        }
+    }
+    return 0;
+}
+
+
+u32 profiler_sample_slot(allocator_profiler_t* allocator, const byte_t* memory) {
+    return (u32) profiler_hash(memory, 0) & (PROFILER_MAX_SAMPLES - 1);
+}
+
+void profiler_sample(allocator_profiler_t* allocator, const byte_t* memory, word_t size, source_location_t location) {
+    u64 bytes = ((u64) size > allocator->sample_period) ? (u64) size : allocator->sample_period;
+    u64 count = (size > 0) ? bytes / (u64) size : 1;
+
+    profiler_lock(allocator);
+    u32 site_index = 0;
+    profiler_site_t* site = profiler_find_site(allocator, location, &site_index);
+    if (site == 0 || allocator->m_samples_live >= PROFILER_MAX_SAMPLES / 2) {
+        allocator->m_dropped += 1;
+        profiler_unlock(allocator);
+        return;
+    }
+
+    site->allocated_bytes += bytes;
+    site->allocated_count += count;
+    site->live_bytes      += (i64) bytes;
+    site->live_count      += (i64) count;
+
+    u32 mask = PROFILER_MAX_SAMPLES - 1;
+    u32 i    = profiler_sample_slot(allocator, memory);
+    while (allocator->m_samples[i].memory != 0)
+        i = (i + 1) & mask;
+    allocator->m_samples_live += 1;
+
+    allocator->m_samples[i].site  = site_index;
+    allocator->m_samples[i].bytes = bytes;
+    allocator->m_samples[i].count = count;
+    __atomic_store_n(&allocator->m_samples[i].memory, memory, __ATOMIC_RELEASE);
+    profiler_unlock(allocator);
+}
+
+
+void profiler_on_allocate(allocator_profiler_t* allocator, const byte_t* memory, word_t size, source_location_t location) {
+    profiler_bytes_until_sample -= size;
+    if (profiler_bytes_until_sample > 0)
+        return;
+    profiler_bytes_until_sample = profiler_next_interval(allocator);
+    profiler_sample(allocator, memory, size, location);
+}
+
+
+// Returns whether `memory` might be a live sample, without taking the lock.
+int profiler_maybe_sampled(allocator_profiler_t* allocator, const byte_t* memory) {
+    u32 mask = PROFILER_MAX_SAMPLES - 1;
+    for (;;) {
+        u32 version = __atomic_load_n(&allocator->m_version, __ATOMIC_ACQUIRE);
+        if (version & 1) {
+            sched_yield();
+            continue;
+        }
+
+        u32 i = profiler_sample_slot(allocator, memory);
+        for (u32 probes = 0; probes < PROFILER_MAX_SAMPLES; ++probes, i = (i + 1) & mask) {
+            const byte_t* key = __atomic_load_n(&allocator->m_samples[i].memory, __ATOMIC_ACQUIRE);
+            if (key == memory)
+                return 1;
+            if (key == 0)
+                break;
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&allocator->m_version, __ATOMIC_RELAXED) == version)
+            return 0;
+    }
+}
+
+
+// Removes the sample at `i` and shifts back the entries after it that would otherwise be cut off
+// from their slot. Must hold the lock.
+void profiler_remove_sample(allocator_profiler_t* allocator, u32 i) {
+    u32 mask = PROFILER_MAX_SAMPLES - 1;
+    __atomic_add_fetch(&allocator->m_version, 1, __ATOMIC_SEQ_CST);
+
+    u32 j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        const byte_t* memory = allocator->m_samples[j].memory;
+        if (memory == 0)
+            break;
+
+        // Entries whose slot is cyclically in (i, j] are still reachable.
+        u32 k = profiler_sample_slot(allocator, memory);
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+
+        allocator->m_samples[i].site  = allocator->m_samples[j].site;
+        allocator->m_samples[i].bytes = allocator->m_samples[j].bytes;
+        allocator->m_samples[i].count = allocator->m_samples[j].count;
+        __atomic_store_n(&allocator->m_samples[i].memory, memory, __ATOMIC_RELAXED);
+        i = j;
+    }
+    __atomic_store_n(&allocator->m_samples[i].memory, 0, __ATOMIC_RELAXED);
+    allocator->m_samples_live -= 1;
+
+    __atomic_add_fetch(&allocator->m_version, 1, __ATOMIC_SEQ_CST);
+}
+
+
+void profiler_on_free(allocator_profiler_t* allocator, const byte_t* memory) {
+    if (!profiler_maybe_sampled(allocator, memory))
+        return;
+
+    u32 mask = PROFILER_MAX_SAMPLES - 1;
+    profiler_lock(allocator);
+    u32 i = profiler_sample_slot(allocator, memory);
+    for (u32 probes = 0; probes < PROFILER_MAX_SAMPLES && allocator->m_samples[i].memory != 0; ++probes, i = (i + 1) & mask) {
+        profiler_sample_t* sample = &allocator->m_samples[i];
+        if (sample->memory == memory) {
+            profiler_site_t* site = &allocator->m_sites[sample->site];
+            site->live_bytes -= (i64) sample->bytes;
+            site->live_count -= (i64) sample->count;
+            profiler_remove_sample(allocator, i);
+            break;
+        }
+    }
+    profiler_unlock(allocator);
+}
+
+
+// Forgets every live sample, for when the child is freed all at once.
+void profiler_on_free_all(allocator_profiler_t* allocator) {
+    profiler_lock(allocator);
+    for (u32 i = 0; i < PROFILER_MAX_SITES; ++i) {
+        allocator->m_sites[i].live_bytes = 0;
+        allocator->m_sites[i].live_count = 0;
+    }
+    __atomic_add_fetch(&allocator->m_version, 1, __ATOMIC_SEQ_CST);
+    for (u32 i = 0; i < PROFILER_MAX_SAMPLES; ++i) {
+        __atomic_store_n(&allocator->m_samples[i].memory, 0, __ATOMIC_RELAXED);
+    }
+    allocator->m_samples_live = 0;
+    __atomic_add_fetch(&allocator->m_version, 1, __ATOMIC_SEQ_CST);
+    profiler_unlock(allocator);
+}
+
+
+int profiler_compare_live_bytes(const void* a, const void* b) {
+    const profiler_site_t* site_a = *(const profiler_site_t* const*) a;
+    const profiler_site_t* site_b = *(const profiler_site_t* const*) b;
+    return (site_a->live_bytes < site_b->live_bytes) - (site_a->live_bytes > site_b->live_bytes);
+}
+
+// Writes every call site, sorted by live bytes, with the allocation rate since the previous report.
+void profiler_report(allocator_profiler_t* allocator, FILE* output) {
+    profiler_site_t* sites[PROFILER_MAX_SITES];
+    u32 count = 0;
+
+    profiler_lock(allocator);
+    f64 now     = profiler_now();
+    f64 elapsed = now - allocator->m_reported_time;
+    allocator->m_reported_time = now;
+
+    for (u32 i = 0; i < PROFILER_MAX_SITES; ++i) {
+        if (allocator->m_sites[i].file != 0)
+            sites[count++] = &allocator->m_sites[i];
+    }
+    qsort(sites, count, sizeof(sites[0]), profiler_compare_live_bytes);
+
+    fprintf(output, "%14s %12s %16s %14s  %s\n", "live bytes", "live count", "allocated bytes", "bytes/s", "site");
+    for (u32 i = 0; i < count; ++i) {
+        profiler_site_t* site = sites[i];
+        f64 rate = (elapsed > 0) ? (f64) (site->allocated_bytes - site->reported_bytes) / elapsed : 0.0;
+        site->reported_bytes = site->allocated_bytes;
+        fprintf(output, "%14lld %12lld %16llu %14.0f  %s:%d (%s)\n",
+                (long long) site->live_bytes, (long long) site->live_count, (unsigned long long) site->allocated_bytes,
+                rate, site->file, site->line, site->function);
+    }
+    if (allocator->m_dropped != 0)
+        fprintf(output, "%llu samples dropped\n", (unsigned long long) allocator->m_dropped);
+    profiler_unlock(allocator);
+}
+
+
+allocation_result_t allocator_profiler_proc(void* allocator_raw, allocation_arguments_t arguments) {
+    allocator_profiler_t* allocator = (allocator_profiler_t*) allocator_raw;
+    switch (arguments.mode) {
+        case ALLOCATE:
+        case ALLOCATE_ALIGNED: {
+            allocation_result_t result = allocator->child.procedure(allocator->child.data, arguments);
+            word_t size = (arguments.mode == ALLOCATE) ? arguments.allocate.size : arguments.allocate_aligned.size;
+            if (allocation_succeeded(result.memory) && result.memory != 0)
+                profiler_on_allocate(allocator, result.memory, size, arguments.location);
+            return result;
+        }
+        case RESIZE: {
+            // @NOTE: The old memory is forgotten first since the child may hand it to another thread
+            //        right away. If the resize then fails, it's no longer counted.
+            if (arguments.resize.memory != 0)
+                profiler_on_free(allocator, arguments.resize.memory);
+            allocation_result_t result = allocator->child.procedure(allocator->child.data, arguments);
+            if (allocation_succeeded(result.memory) && result.memory != 0)
+                profiler_on_allocate(allocator, result.memory, arguments.resize.new_size, arguments.location);
+            return result;
+        }
+        case FREE:
+            if (arguments.free.memory != 0)
+                profiler_on_free(allocator, arguments.free.memory);
+            return allocator->child.procedure(allocator->child.data, arguments);
+        case FREE_ALL:
+            profiler_on_free_all(allocator);
+            return allocator->child.procedure(allocator->child.data, arguments);
+
+        case ALLOCATE_ALL:
+        case QUERY_USED:
+        case QUERY_OWNS:
+        case QUERY_CAPACITY:
+        case QUERY_ALIGNMENT:
+        case QUERY_GOOD_SIZE:
+        case QUERY_ALLOCATION_SIZE:
+        case QUERY_USABLE_SIZE:
+            return allocator->child.procedure(allocator->child.data, arguments);
+    }
+}
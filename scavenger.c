@@ -0,0 +1,314 @@
+/* Gives memory that has been free for a while back to the OS.
+ *
+ * Strategies are registered with the scavenger, which on every `scavenge` looks at where each
+ * one's free tail begins: above `m_pointer` for a stack, and after the last block in use for a
+ * freelist. How far each has been handed out since the last release (`m_peak` for a stack,
+ * `m_untouched` for a freelist) tells it which released pages a burst has dirtied again. Pages
+ * in a tail that stayed free for a whole `idle_seconds` window are released with madvise, so
+ * RSS follows the actual use instead of the peak. Touching them again simply faults them back in.
+ *
+ * A freelist also has its blocks that stayed free for the whole window tracked, and every run
+ * of them that covers whole pages below the tail is released too. As free blocks hold the
+ * list's links, the released blocks are taken out of the list: those in the tail become
+ * untouched, and the others a released run of the freelist, whose first block keeps the run's
+ * header resident. Neither is read before it's handed out again.
+ *
+ * The large allocator needs no scavenging, since it unmaps on FREE.
+ *
+ * `scavenge` can be called explicitly, or from a background thread with `scavenger_start`. An
+ * allocator that is used from another thread than the one scavenging must be registered with
+ * the mutex that guards it.
+ */
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SCAVENGER_MAX_ENTRIES 64
+
+
+typedef enum {
+    SCAVENGER_STACK,
+    SCAVENGER_FREELIST,
+} scavenger_kind_t;
+
+typedef struct {
+    scavenger_kind_t kind;
+    void*            allocator;
+    pthread_mutex_t* lock;              // Optional.
+    byte_t*          m_tail_peak;       // Highest start of the free tail seen in the current window.
+    byte_t*          m_released;        // Everything from here to the end has been released.
+    f64              m_window_start;
+    u64*             m_free_blocks;     // A freelist's free blocks at the latest scavenge.
+    u64*             m_idle_blocks;     // A freelist's blocks that have been free at every scavenge of the window.
+} scavenger_entry_t;
+
+typedef struct {
+    f64    idle_seconds;
+    int    advice;                      // MADV_DONTNEED drops the pages right away, MADV_FREE when memory is needed.
+    size_t m_page_size;
+    size_t m_released_bytes;            // In total, including pages that have since been faulted back in.
+    u32    m_count;
+    scavenger_entry_t m_entries[SCAVENGER_MAX_ENTRIES];
+
+    pthread_mutex_t m_mutex;
+    pthread_cond_t  m_wake;
+    pthread_t       m_thread;
+    int             m_running;
+} scavenger_t;
+
+
+f64 scavenger_now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (f64) time.tv_sec + (f64) time.tv_nsec * 1e-9;
+}
+
+
+void scavenger_init(scavenger_t* scavenger, f64 idle_seconds) {
+    memset(scavenger, 0, sizeof(*scavenger));
+    scavenger->idle_seconds = idle_seconds;
+    scavenger->advice       = MADV_DONTNEED;
+    scavenger->m_page_size  = (size_t) sysconf(_SC_PAGESIZE);
+    pthread_mutex_init(&scavenger->m_mutex, 0);
+    pthread_cond_init(&scavenger->m_wake, 0);
+}
+
+
+byte_t* scavenger_region_end(scavenger_entry_t* entry) {
+    if (entry->kind == SCAVENGER_STACK) {
+        allocator_stack_t* stack = (allocator_stack_t*) entry->allocator;
+        return stack->m_memory + stack->m_capacity;
+    } else {
+        allocator_freelist_t* freelist = (allocator_freelist_t*) entry->allocator;
+        return freelist->m_memory + freelist_capacity(freelist);
+    }
+}
+
+
+void scavenger_register(scavenger_t* scavenger, scavenger_kind_t kind, void* allocator, pthread_mutex_t* lock) {
+    pthread_mutex_lock(&scavenger->m_mutex);
+    ASSERTF(scavenger->m_count < SCAVENGER_MAX_ENTRIES, "More than %d allocators registered!", SCAVENGER_MAX_ENTRIES);
+    scavenger_entry_t* entry = &scavenger->m_entries[scavenger->m_count++];
+    *entry = (scavenger_entry_t) { .kind=kind, .allocator=allocator, .lock=lock, .m_window_start=scavenger_now() };
+    entry->m_tail_peak = 0;
+    entry->m_released  = scavenger_region_end(entry);
+    if (kind == SCAVENGER_FREELIST) {
+        size_t words = ((size_t) ((allocator_freelist_t*) allocator)->m_count + 63) / 64;
+        entry->m_free_blocks = (u64*) nax_allocate_type(allocator_malloc, u64, words);
+        entry->m_idle_blocks = (u64*) nax_allocate_type(allocator_malloc, u64, words);
+        ASSERTF(allocation_succeeded((byte_t*) entry->m_free_blocks) && allocation_succeeded((byte_t*) entry->m_idle_blocks), "Out of memory for the scavenger's bitmaps!");
+        memset(entry->m_idle_blocks, 0xFF, words * sizeof(u64));
+    }
+    pthread_mutex_unlock(&scavenger->m_mutex);
+}
+
+void scavenger_register_stack(scavenger_t* scavenger, allocator_stack_t* allocator, pthread_mutex_t* lock) {
+    scavenger_register(scavenger, SCAVENGER_STACK, allocator, lock);
+}
+
+void scavenger_register_freelist(scavenger_t* scavenger, allocator_freelist_t* allocator, pthread_mutex_t* lock) {
+    scavenger_register(scavenger, SCAVENGER_FREELIST, allocator, lock);
+}
+
+
+// Releases the whole pages in [from, to).
+size_t scavenger_release(scavenger_t* scavenger, byte_t* from, byte_t* to) {
+    byte_t* first = (byte_t*) align_address((size_t) from, scavenger->m_page_size);
+    byte_t* last  = (byte_t*) ((size_t) to & ~(scavenger->m_page_size - 1));
+    if (first >= last)
+        return 0;
+    if (madvise(first, (size_t) (last - first), scavenger->advice) != 0)
+        return 0;
+    return (size_t) (last - first);
+}
+
+
+// Makes every run of blocks that stayed idle for the window and covers whole pages a released run
+// of the freelist and gives its pages back. Only blocks below the untouched ones are looked at.
+size_t scavenger_release_freelist_runs(scavenger_t* scavenger, scavenger_entry_t* entry) {
+    allocator_freelist_t* freelist = (allocator_freelist_t*) entry->allocator;
+    u64*   idle       = entry->m_idle_blocks;
+    size_t block_size = freelist->m_block_size;
+    size_t memory     = (size_t) freelist->m_memory;
+    size_t released   = 0;
+    int    added      = 0;
+    if (block_size < sizeof(freelist_run_t))
+        return 0;
+
+    freelist_unmark_runs(freelist, idle);
+    u32 end   = freelist->m_untouched;
+    u32 block = 0;
+    while (block < end) {
+        if (!(idle[block / 64] & (1ULL << (block % 64)))) {
+            block += 1;
+            continue;
+        }
+        u32 begin = block;
+        while (block < end && (idle[block / 64] & (1ULL << (block % 64))))
+            block += 1;
+
+        // The run's header must stay resident, so it goes in the block that starts before the
+        // pages if there is one, and otherwise the pages start after the header.
+        size_t first = align_address(memory + (size_t) begin * block_size, scavenger->m_page_size);
+        size_t last  = (memory + (size_t) block * block_size) & ~(scavenger->m_page_size - 1);
+        u32    head  = (u32) ((first - memory + block_size - 1) / block_size);
+        if (head > begin)
+            head -= 1;
+        else
+            first = align_address(memory + (size_t) head * block_size + sizeof(freelist_run_t), scavenger->m_page_size);
+        if (first >= last)
+            continue;
+
+        // Every block that starts before `last` loses its link, so they all go in the run.
+        freelist_add_run(freelist, head, (u32) ((last - memory + block_size - 1) / block_size));
+        added     = 1;
+        released += scavenger_release(scavenger, (byte_t*) first, (byte_t*) last);
+    }
+
+    if (added)
+        freelist_untouch_from(freelist, entry->m_free_blocks, freelist->m_untouched);
+    return released;
+}
+
+
+size_t scavenger_scavenge_entry(scavenger_t* scavenger, scavenger_entry_t* entry, f64 now) {
+    allocator_stack_t*    stack       = (allocator_stack_t*)    entry->allocator;
+    allocator_freelist_t* freelist    = (allocator_freelist_t*) entry->allocator;
+    u64*                  free_blocks = entry->m_free_blocks;
+
+    // Where the free tail starts, and where memory has been handed out from since the last release.
+    byte_t* tail    = 0;
+    byte_t* touched = 0;
+    if (entry->kind == SCAVENGER_STACK) {
+        tail    = stack->m_memory + stack->m_pointer;
+        touched = stack->m_memory + stack->m_peak;
+    } else {
+        freelist_mark_free(freelist, free_blocks);
+        for (size_t i = 0; i < ((size_t) freelist->m_count + 63) / 64; ++i)
+            entry->m_idle_blocks[i] &= free_blocks[i];
+        tail    = freelist->m_memory + (size_t) freelist_free_tail(freelist, free_blocks) * freelist->m_block_size;
+        touched = freelist->m_memory + (size_t) freelist->m_untouched * freelist->m_block_size;
+    }
+
+    // Pages that were handed out again are back in memory.
+    if (touched > entry->m_released)
+        entry->m_released = touched;
+    if (entry->m_tail_peak == 0 || tail > entry->m_tail_peak)
+        entry->m_tail_peak = tail;
+
+    size_t released = 0;
+    if (now - entry->m_window_start >= scavenger->idle_seconds) {
+        if (entry->m_tail_peak < entry->m_released) {
+            byte_t* from = entry->m_tail_peak;
+            if (entry->kind == SCAVENGER_FREELIST) {
+                // Round up to a block, and make the blocks from there untouched before giving their memory away.
+                u32 index = (u32) (((size_t) (from - freelist->m_memory) + freelist->m_block_size - 1) / freelist->m_block_size);
+                freelist_untouch_from(freelist, free_blocks, index);
+                from = freelist->m_memory + (size_t) index * freelist->m_block_size;
+            }
+            released = scavenger_release(scavenger, from, entry->m_released);
+            entry->m_released = from;
+            if (entry->kind == SCAVENGER_STACK)
+                stack->m_peak = (u32) (from - stack->m_memory);
+        }
+        if (entry->kind == SCAVENGER_FREELIST) {
+            released += scavenger_release_freelist_runs(scavenger, entry);
+            memcpy(entry->m_idle_blocks, free_blocks, ((size_t) freelist->m_count + 63) / 64 * sizeof(u64));
+        }
+        entry->m_tail_peak    = tail;
+        entry->m_window_start = now;
+    }
+    return released;
+}
+
+
+// Releases what has been idle long enough. Returns the number of bytes released.
+size_t scavenge(scavenger_t* scavenger) {
+    size_t released = 0;
+    f64    now      = scavenger_now();
+
+    pthread_mutex_lock(&scavenger->m_mutex);
+    for (u32 i = 0; i < scavenger->m_count; ++i) {
+        scavenger_entry_t* entry = &scavenger->m_entries[i];
+        if (entry->lock != 0)
+            pthread_mutex_lock(entry->lock);
+        released += scavenger_scavenge_entry(scavenger, entry, now);
+        if (entry->lock != 0)
+            pthread_mutex_unlock(entry->lock);
+    }
+    scavenger->m_released_bytes += released;
+    pthread_mutex_unlock(&scavenger->m_mutex);
+
+    return released;
+}
+
+
+void* scavenger_thread(void* scavenger_raw) {
+    scavenger_t* scavenger = (scavenger_t*) scavenger_raw;
+    // Twice per window, so a tail that went idle right after a window started is released after at most one and a half.
+    f64 interval = scavenger->idle_seconds / 2;
+
+    pthread_mutex_lock(&scavenger->m_mutex);
+    while (scavenger->m_running) {
+        f64 wake_at = scavenger_now() + interval;
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec  += (time_t) interval;
+        deadline.tv_nsec += (long) ((interval - (f64) (time_t) interval) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec  += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (scavenger->m_running && scavenger_now() < wake_at) {
+            if (pthread_cond_timedwait(&scavenger->m_wake, &scavenger->m_mutex, &deadline) != 0)
+                break;
+        }
+        if (!scavenger->m_running)
+            break;
+
+        pthread_mutex_unlock(&scavenger->m_mutex);
+        scavenge(scavenger);
+        pthread_mutex_lock(&scavenger->m_mutex);
+    }
+    pthread_mutex_unlock(&scavenger->m_mutex);
+    return 0;
+}
+
+
+int scavenger_start(scavenger_t* scavenger) {
+    pthread_mutex_lock(&scavenger->m_mutex);
+    ASSERTF(!scavenger->m_running, "The scavenger is already running!");
+    scavenger->m_running = 1;
+    pthread_mutex_unlock(&scavenger->m_mutex);
+
+    if (pthread_create(&scavenger->m_thread, 0, scavenger_thread, scavenger) != 0) {
+        scavenger->m_running = 0;
+        return 0;
+    }
+    return 1;
+}
+
+void scavenger_stop(scavenger_t* scavenger) {
+    pthread_mutex_lock(&scavenger->m_mutex);
+    int was_running = scavenger->m_running;
+    scavenger->m_running = 0;
+    pthread_cond_signal(&scavenger->m_wake);
+    pthread_mutex_unlock(&scavenger->m_mutex);
+
+    if (was_running)
+        pthread_join(scavenger->m_thread, 0);
+}
+
+// Stops the background thread, if any, and frees what the scavenger holds. The allocators are untouched.
+void scavenger_destroy(scavenger_t* scavenger) {
+    scavenger_stop(scavenger);
+    for (u32 i = 0; i < scavenger->m_count; ++i) {
+        if (scavenger->m_entries[i].kind == SCAVENGER_FREELIST) {
+            nax_free(allocator_malloc, (byte_t*) scavenger->m_entries[i].m_free_blocks);
+            nax_free(allocator_malloc, (byte_t*) scavenger->m_entries[i].m_idle_blocks);
+        }
+    }
+    pthread_cond_destroy(&scavenger->m_wake);
+    pthread_mutex_destroy(&scavenger->m_mutex);
+    memset(scavenger, 0, sizeof(*scavenger));
+}
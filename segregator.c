@@ -1,14 +1,202 @@
+/* Sends allocations up to `threshold` to the primary and everything else to the secondary.
+ *
+ * With `adaptive` set, the segregator keeps a histogram of the requested sizes and how often
+ * the primary ran out, and every `interval` requests proposes the threshold at which the primary
+ * takes as many requests as it has capacity for. It only moves there if the histogram says the
+ * primary would serve a larger share of the requests than at the current threshold, so a stable
+ * workload keeps its threshold. A request the primary can't take then falls back to the
+ * secondary instead of failing. Existing allocations are always found through the primary's
+ * QUERY_OWNS, so moving the threshold doesn't affect them.
+ */
+#define SEGREGATOR_BUCKETS      32     // Request sizes are counted per power of two.
+#define SEGREGATOR_FILL_TARGET  0.9    // How much of the primary's capacity the threshold aims to use.
+#define SEGREGATOR_HYSTERESIS   0.02   // How much larger a share of hits a new threshold must promise.
+
+typedef struct {
+    word_t threshold;
+    word_t previous_threshold;
+    u32    hits;                      // Primary allocations in the interval before the decision.
+    u32    misses;                    // Requests under the threshold the primary couldn't take.
+    size_t estimated_primary_bytes;   // Live bytes the new threshold is expected to put in the primary.
+    u32    decisions;
+} segregator_decision_t;
+
+typedef struct {
+    word_t maximum_threshold;         // The largest size the primary can take at all, e.g. a freelist's block size.
+    u32    interval;                  // Requests between each decision.
+    u32    m_requests;
+    u32    m_hits;
+    u32    m_misses;
+    u64    m_live;                    // Allocations made through the segregator and not yet freed.
+    u64    m_counts[SEGREGATOR_BUCKETS];
+    u64    m_bytes[SEGREGATOR_BUCKETS];
+    segregator_decision_t m_decision;
+} segregator_adaptive_t;
+
 typedef struct {
     allocator_t primary;
     allocator_t secondary;
     word_t threshold;
+    segregator_adaptive_t* adaptive;  // Optional.
 } allocator_segregator_t;
 
 
+segregator_adaptive_t segregator_adaptive_init(word_t maximum_threshold, u32 interval) {
+    ASSERTF(interval > 0, "Interval must be positive!");
+    return (segregator_adaptive_t) {
+            .maximum_threshold = maximum_threshold,
+            .interval          = interval,
+    };
+}
+
+
+// Index of the smallest power of two that is at least `size`.
+u32 segregator_bucket(word_t size) {
+    if (size <= 1)
+        return 0;
+    u32 bucket = 64 - (u32) __builtin_clzll((u64) (size - 1));
+    return (bucket < SEGREGATOR_BUCKETS) ? bucket : SEGREGATOR_BUCKETS - 1;
+}
+
+
+// The share of requests the primary is expected to serve with `threshold`: those under it, but
+// no more than the primary can hold when it fills up with them in the order they come.
+f64 segregator_expected_hits(segregator_adaptive_t* adaptive, word_t threshold, size_t capacity, size_t good_size, u64 total_count) {
+    f64 count = 0.0;
+    f64 cost  = 0.0;
+    for (u32 i = 0; i < SEGREGATOR_BUCKETS; ++i) {
+        word_t bucket_size = (word_t) 1 << i;
+        word_t lower       = (i == 0) ? 0 : (word_t) 1 << (i - 1);
+        if (threshold <= lower)
+            break;
+
+        // Assume the sizes of a partly covered bucket are spread evenly, as segregator_decide does.
+        f64 share       = (threshold >= bucket_size) ? 1.0 : (f64) (threshold - lower) / (f64) (bucket_size - lower);
+        u64 bucket_cost = adaptive->m_bytes[i];
+        if (bucket_cost < adaptive->m_counts[i] * good_size)
+            bucket_cost = adaptive->m_counts[i] * good_size;
+        count += share * (f64) adaptive->m_counts[i];
+        cost  += share * (f64) bucket_cost;
+    }
+    if (count == 0.0)
+        return 0.0;
+
+    f64 under = count / (f64) total_count;
+    f64 fits  = (f64) capacity / ((f64) adaptive->m_live * cost / count);
+    return (under < fits) ? under : fits;
+}
+
+
+// Picks the largest threshold for which the expected live allocations under it fit
+// in the primary. Covering the smallest sizes first is what gives the most hits per byte of capacity.
+void segregator_decide(allocator_segregator_t* allocator) {
+    segregator_adaptive_t* adaptive = allocator->adaptive;
+
+    size_t capacity  = nax_query_capacity(allocator->primary);
+    size_t good_size = nax_query_good_size(allocator->primary);
+    if (good_size == ALLOCATION_QUERY_UNSUPPORTED || good_size == 0)
+        good_size = 1;
+
+    u64 total_count = 0;
+    for (u32 i = 0; i < SEGREGATOR_BUCKETS; ++i)
+        total_count += adaptive->m_counts[i];
+
+    word_t threshold = allocator->threshold;
+    size_t estimated = 0;
+    if (capacity != ALLOCATION_QUERY_UNSUPPORTED && total_count > 0) {
+        f64 budget = (f64) capacity * SEGREGATOR_FILL_TARGET;
+        f64 sum    = 0.0;
+        threshold  = 0;
+        for (u32 i = 0; i < SEGREGATOR_BUCKETS; ++i) {
+            word_t bucket_size = (word_t) 1 << i;
+            if (bucket_size > adaptive->maximum_threshold)
+                break;
+
+            // What this bucket's share of the live allocations would cost in the primary.
+            u64 cost = adaptive->m_bytes[i];
+            if (cost < adaptive->m_counts[i] * good_size)
+                cost = adaptive->m_counts[i] * good_size;
+            f64 bucket_bytes = (f64) adaptive->m_live * (f64) cost / (f64) total_count;
+
+            if (sum + bucket_bytes > budget) {
+                // Only part of the bucket fits. Assume its sizes are spread evenly and cut it there.
+                word_t lower = (i == 0) ? 0 : (word_t) 1 << (i - 1);
+                threshold = lower + (word_t) ((f64) (bucket_size - lower) * (budget - sum) / bucket_bytes);
+                estimated = (size_t) budget;
+                break;
+            }
+
+            sum      += bucket_bytes;
+            threshold = bucket_size;
+            estimated = (size_t) sum;
+        }
+    }
+
+    // Running out despite the estimate means the primary is busier than the sizes suggest.
+    if (adaptive->m_misses > 0 && threshold >= allocator->threshold) {
+        threshold = allocator->threshold - allocator->threshold / 8;
+    }
+    if (threshold > adaptive->maximum_threshold)
+        threshold = adaptive->maximum_threshold;
+
+    // A primary with fixed-size blocks is as full with any threshold that fills it, so a lower one
+    // would only turn away requests it could have taken. Move only for a clear gain in hits.
+    if (capacity != ALLOCATION_QUERY_UNSUPPORTED && total_count > 0 && adaptive->m_live > 0) {
+        f64 current  = segregator_expected_hits(adaptive, allocator->threshold, capacity, good_size, total_count);
+        f64 proposed = segregator_expected_hits(adaptive, threshold,            capacity, good_size, total_count);
+        if (proposed < current + SEGREGATOR_HYSTERESIS)
+            threshold = allocator->threshold;
+    }
+
+    adaptive->m_decision = (segregator_decision_t) {
+            .threshold               = threshold,
+            .previous_threshold      = allocator->threshold,
+            .hits                    = adaptive->m_hits,
+            .misses                  = adaptive->m_misses,
+            .estimated_primary_bytes = estimated,
+            .decisions               = adaptive->m_decision.decisions + 1,
+    };
+    allocator->threshold = threshold;
+
+    adaptive->m_requests = 0;
+    adaptive->m_hits     = 0;
+    adaptive->m_misses   = 0;
+    memset(adaptive->m_counts, 0, sizeof(adaptive->m_counts));
+    memset(adaptive->m_bytes,  0, sizeof(adaptive->m_bytes));
+}
+
+
+void segregator_observe(allocator_segregator_t* allocator, word_t size) {
+    segregator_adaptive_t* adaptive = allocator->adaptive;
+    u32 bucket = segregator_bucket(size);
+    adaptive->m_counts[bucket] += 1;
+    adaptive->m_bytes[bucket]  += (u64) size;
+    adaptive->m_live           += 1;
+    if (++adaptive->m_requests >= adaptive->interval)
+        segregator_decide(allocator);
+}
+
+
+// What the adaptive segregator last decided, and on what.
+segregator_decision_t segregator_query_decision(allocator_segregator_t* allocator) {
+    if (allocator->adaptive == 0)
+        return (segregator_decision_t) { .threshold=allocator->threshold, .previous_threshold=allocator->threshold };
+    return allocator->adaptive->m_decision;
+}
+
+
 allocation_result_t segregator_allocate(allocator_segregator_t* allocator, word_t size) {
     byte_t* memory = 0;
     if (size <= allocator->threshold) {
         memory = nax_allocate(allocator->primary, size);
+        if (allocator->adaptive != 0) {
+            if (allocation_succeeded(memory)) {
+                allocator->adaptive->m_hits += 1;
+            } else {
+                allocator->adaptive->m_misses += 1;
+                memory = nax_allocate(allocator->secondary, size);
+            }
+        }
         if (!allocation_succeeded(memory))
             return make_allocation_error((allocation_status_t)(size_t) memory);
     } else {
@@ -16,6 +204,8 @@ allocation_result_t segregator_allocate(allocator_segregator_t* allocator, word_
         if (!allocation_succeeded(memory))
             return make_allocation_error((allocation_status_t)(size_t) memory);
     }
+    if (allocator->adaptive != 0)
+        segregator_observe(allocator, size);
     return make_allocation_result(memory);
 }
 
@@ -25,6 +215,14 @@ allocation_result_t segregator_allocate_aligned(allocator_segregator_t* allocato
     byte_t* memory = 0;
     if (size <= allocator->threshold) {
         memory = nax_allocate_aligned(allocator->primary, size, alignment);
+        if (allocator->adaptive != 0) {
+            if (allocation_succeeded(memory)) {
+                allocator->adaptive->m_hits += 1;
+            } else {
+                allocator->adaptive->m_misses += 1;
+                memory = nax_allocate_aligned(allocator->secondary, size, alignment);
+            }
+        }
         if (!allocation_succeeded(memory))
             return make_allocation_error((allocation_status_t)(size_t) memory);
     } else {
@@ -32,19 +230,52 @@ allocation_result_t segregator_allocate_aligned(allocator_segregator_t* allocato
         if (!allocation_succeeded(memory))
             return make_allocation_error((allocation_status_t)(size_t) memory);
     }
+    if (allocator->adaptive != 0)
+        segregator_observe(allocator, size);
     return make_allocation_result(memory);
 }
 
 
+// Which child an existing allocation came from. The threshold can't tell, since an allocation
+// may have been resized across it, so ask the primary.
+allocator_t segregator_owner(allocator_segregator_t* allocator, const byte_t* memory) {
+    size_t query = nax_query_owns(allocator->primary, memory);
+    ASSERTF(query != ALLOCATION_QUERY_UNSUPPORTED, "The primary must support QUERY_OWNS!");
+    return (query == 1) ? allocator->primary : allocator->secondary;
+}
+
+
 allocation_result_t segregator_resize(allocator_segregator_t* allocator, byte_t* memory, word_t old_size, word_t new_size) {
-    ASSERTF(0, "TODO");
-    return (allocation_result_t) { 0 };
+    if (memory == 0) {
+        return segregator_allocate(allocator, new_size);
+    }
+
+    allocator_t owner  = segregator_owner(allocator, memory);
+    allocator_t target = (new_size <= allocator->threshold) ? allocator->primary : allocator->secondary;
+    if (owner.data == target.data && owner.procedure == target.procedure) {
+        byte_t* result = nax_resize(owner, memory, new_size, old_size);
+        if (!allocation_succeeded(result))
+            return make_allocation_error((allocation_status_t)(size_t) result);
+        return make_allocation_result(result);
+    }
+
+    // Moving across the threshold, keeping the alignment the block had.
+    word_t  alignment = (word_t) address_alignment((size_t) memory, 64);
+    byte_t* result    = nax_allocate_aligned(target, new_size, alignment);
+    if (!allocation_succeeded(result) && allocator->adaptive != 0 && target.data == allocator->primary.data)
+        result = nax_allocate_aligned(allocator->secondary, new_size, alignment);
+    if (!allocation_succeeded(result))
+        return make_allocation_error((allocation_status_t)(size_t) result);
+    memcpy(result, memory, (size_t) ((old_size < new_size) ? old_size : new_size));
+    nax_free(owner, memory);
+    return make_allocation_result(result);
 }
 
 
 allocation_result_t segregator_free(allocator_segregator_t* allocator, byte_t* memory) {
-    ASSERTF(0, "TODO");
-    return (allocation_result_t) { 0 };
+    if (allocator->adaptive != 0 && memory != 0 && allocator->adaptive->m_live > 0)
+        allocator->adaptive->m_live -= 1;
+    return make_free_status((free_status_t) nax_free(segregator_owner(allocator, memory), memory));
 }
 
 
@@ -52,6 +283,8 @@ allocation_result_t segregator_free_all(allocator_segregator_t* allocator) {
     // @TODO: Make sure these do not fail.
     nax_free_all(allocator->primary);
     nax_free_all(allocator->secondary);
+    if (allocator->adaptive != 0)
+        allocator->adaptive->m_live = 0;
     return make_free_status(FREE_STATUS_SUCCEEDED);
 }
 
@@ -90,6 +323,23 @@ allocation_result_t segregator_good_size(allocator_segregator_t* allocator) {
     return make_query_result(minimum_good_size);
 }
 
+// Asks the child the request would go to, instead of taking one number for both.
+allocation_result_t segregator_allocation_size(allocator_segregator_t* allocator, word_t size, word_t alignment) {
+    allocator_t target = (size <= allocator->threshold) ? allocator->primary : allocator->secondary;
+    size_t query = nax_query_allocation_size(target, size, alignment);
+    if (query == 0 && allocator->adaptive != 0 && target.data == allocator->primary.data)
+        query = nax_query_allocation_size(allocator->secondary, size, alignment);
+
+    // Asking for more than the threshold would send the request to the secondary.
+    if (size <= allocator->threshold && query != ALLOCATION_QUERY_UNSUPPORTED && query > (size_t) allocator->threshold)
+        query = (size_t) allocator->threshold;
+    return make_query_result(query);
+}
+
+allocation_result_t segregator_usable_size(allocator_segregator_t* allocator, const byte_t* memory) {
+    return make_query_result(nax_query_usable_size(segregator_owner(allocator, memory), memory));
+}
+
 allocation_result_t segregator_capacity(allocator_segregator_t* allocator) {
     size_t query_1 = nax_query_capacity(allocator->primary);
     size_t query_2 = nax_query_capacity(allocator->secondary);
@@ -133,5 +383,7 @@ allocation_result_t allocator_segregator_proc(void* allocator_raw, allocation_ar
         case QUERY_CAPACITY:    return segregator_capacity(allocator);
         case QUERY_ALIGNMENT:   return segregator_alignment(allocator);
         case QUERY_GOOD_SIZE:   return segregator_good_size(allocator);
+        case QUERY_ALLOCATION_SIZE: return segregator_allocation_size(allocator, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
+        case QUERY_USABLE_SIZE:     return segregator_usable_size(allocator, arguments.usable_size.memory);
     }
 }
@@ -2,6 +2,7 @@ typedef struct {
     byte_t* m_memory;
     u32     m_pointer;
     u32     m_capacity;
+    u32     m_peak;       // Highest `m_pointer` has been since the scavenger last released the rest.
 } allocator_stack_t;
 
 
@@ -12,17 +13,26 @@ allocator_stack_t allocator_stack_init(byte_t* memory, u32 capacity) {
     return (allocator_stack_t) {
             .m_memory   = memory,
             .m_pointer  = 0,
-            .m_capacity = capacity
+            .m_capacity = capacity,
+            .m_peak     = 0,
     };
 }
 
 
+// Called after `m_pointer` grows, so the scavenger sees bursts that were freed again before it ran.
+void stack_update_peak(allocator_stack_t* allocator) {
+    if (allocator->m_pointer > allocator->m_peak)
+        allocator->m_peak = allocator->m_pointer;
+}
+
+
 allocation_result_t stack_allocate(allocator_stack_t* allocator, word_t size) {
     if (allocator->m_pointer + (size_t) size > allocator->m_capacity) {
         return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
     } else {
         byte_t* memory = allocator->m_memory + allocator->m_pointer;
         allocator->m_pointer += (u32) size;
+        stack_update_peak(allocator);
         return make_allocation_result(memory);
     }
 }
@@ -37,6 +47,7 @@ allocation_result_t stack_allocate_aligned(allocator_stack_t* allocator, word_t
     } else {
         byte_t* memory = (byte_t*) aligned_address;
         allocator->m_pointer += (u32) size + alignment_padding;
+        stack_update_peak(allocator);
         return make_allocation_result(memory);
     }
 }
@@ -47,6 +58,7 @@ allocation_result_t stack_allocate_all(allocator_stack_t* allocator) {
     } else {
         byte_t* memory = allocator->m_memory + allocator->m_pointer;
         allocator->m_pointer = allocator->m_capacity;
+        stack_update_peak(allocator);
         return make_allocation_result(memory);
     }
 }
@@ -58,16 +70,29 @@ allocation_result_t stack_resize(allocator_stack_t* allocator, byte_t* old_memor
     }
 
     ASSERT(stack_owns(allocator, old_memory));
-    ASSERT(old_size == ((allocator->m_memory + allocator->m_pointer) - (byte_t *) old_memory));
 
-    allocator->m_pointer -= (u32)old_size;
-    if (allocator->m_pointer + (u32)new_size > allocator->m_capacity) {
-        return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
-    } else {
-        byte_t* memory = allocator->m_memory + allocator->m_pointer;
-        allocator->m_pointer += (u32)new_size;
-        return make_allocation_result(memory);
+    // The latest allocation can grow or shrink in place.
+    if (old_memory + old_size == allocator->m_memory + allocator->m_pointer) {
+        u32 offset = (u32) (old_memory - allocator->m_memory);
+        if (offset + (size_t) new_size > allocator->m_capacity) {
+            return make_allocation_error(ALLOCATION_STATUS_OUT_OF_MEMORY);
+        } else {
+            allocator->m_pointer = offset + (u32) new_size;
+            stack_update_peak(allocator);
+            return make_allocation_result(old_memory);
+        }
+    }
+
+    // Anything below it can only shrink in place (the tail is lost until the stack is rewound).
+    if (new_size <= old_size) {
+        return make_allocation_result(old_memory);
     }
+
+    allocation_result_t result = stack_allocate_aligned(allocator, new_size, (word_t) address_alignment((size_t) old_memory, 64));
+    if (allocation_succeeded(result.memory)) {
+        memcpy(result.memory, old_memory, (size_t) old_size);
+    }
+    return result;
 }
 
 
@@ -111,13 +136,46 @@ size_t stack_capacity(allocator_stack_t* allocator) {
 }
 
 
+// A 32-bit reference into a stack, half the size of a pointer: one past the byte offset from
+// `m_memory`, so that 0 can be null.
+typedef u32 stack_relative_t;
+
+stack_relative_t stack_to_relative(allocator_stack_t* allocator, const void* memory) {
+    if (memory == 0) {
+        return 0;
+    }
+    ASSERTF(allocator->m_memory <= (const byte_t*) memory && (const byte_t*) memory <= allocator->m_memory + allocator->m_capacity, "Memory is not in the stack!");
+    return (stack_relative_t) ((const byte_t*) memory - allocator->m_memory) + 1;
+}
+
+void* stack_from_relative(allocator_stack_t* allocator, stack_relative_t offset) {
+    if (offset == 0) {
+        return 0;
+    }
+    ASSERTF(offset - 1 <= allocator->m_capacity, "Offset %u is not in the stack!", offset);
+    return allocator->m_memory + (offset - 1);
+}
+
+// Returns 0 when out of memory.
+stack_relative_t stack_allocate_relative(allocator_stack_t* allocator, word_t size, word_t alignment) {
+    allocation_result_t result = stack_allocate_aligned(allocator, size, alignment);
+    if (!allocation_succeeded(result.memory)) {
+        return 0;
+    }
+    return stack_to_relative(allocator, result.memory);
+}
+
+#define stack_allocate_relative_type(allocator, type_, count) stack_allocate_relative(allocator, (word_t) ((count) * sizeof(type_)), (word_t) ALIGN_OF(type_))
+#define stack_pointer(allocator, type_, offset) ((type_*) stack_from_relative(allocator, offset))
+
+
 allocation_result_t allocator_stack_proc(void* allocator_raw, allocation_arguments_t arguments) {
     allocator_stack_t* allocator = (allocator_stack_t*) allocator_raw;
     switch (arguments.mode) {
         case ALLOCATE:          return stack_allocate(allocator, arguments.allocate.size);
         case ALLOCATE_ALIGNED:  return stack_allocate_aligned(allocator, arguments.allocate_aligned.size, arguments.allocate_aligned.alignment);
         case ALLOCATE_ALL:      return stack_allocate_all(allocator);
-        case RESIZE:            return stack_resize(allocator, arguments.resize.memory, arguments.resize.old_size, arguments.resize.old_size);
+        case RESIZE:            return stack_resize(allocator, arguments.resize.memory, arguments.resize.old_size, arguments.resize.new_size);
         case FREE:              return stack_free(allocator, arguments.free.memory);
         case FREE_ALL:          return stack_free_all(allocator);
         case QUERY_USED:        return make_query_result(stack_used(allocator));
@@ -125,5 +183,11 @@ allocation_result_t allocator_stack_proc(void* allocator_raw, allocation_argumen
         case QUERY_CAPACITY:    return make_query_result(stack_capacity(allocator));
         case QUERY_ALIGNMENT:
         case QUERY_GOOD_SIZE:   return make_query_result(1);
+        case QUERY_ALLOCATION_SIZE:
+            return make_query_result((size_t) arguments.allocate_aligned.size);
+
+        // @NOTE: Unsupported, sizes aren't stored.
+        case QUERY_USABLE_SIZE:
+            return make_query_result(ALLOCATION_QUERY_UNSUPPORTED);
     }
 }
@@ -0,0 +1,304 @@
+/* An open-addressing hash table that gets its memory from an `allocator_t`.
+ *
+ * Slots are probed linearly and stored as separate arrays in one allocation: a control byte
+ * per slot, then the 32-bit hashes, the keys and the values. A control byte is 0 for an empty
+ * slot and 0x80 | the top 7 bits of the hash for a used one, so a probe compares 16 control
+ * bytes at once (with SSE2 where available) and only touches the keys of likely matches. The
+ * first 15 control bytes are mirrored after the last slot, so a group never has to wrap.
+ * Removal shifts the following entries back instead of leaving tombstones.
+ *
+ * Keys are compared with memcmp. With `arena` set, the storage an earlier growth left behind
+ * is never freed, as on a stack allocator FREE would rewind past the new storage. The table
+ * is then thrown away with `table_reset` once the arena is rewound with FREE_ALL, which
+ * costs nothing no matter how many entries it had.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define TABLE_GROUP_SIZE        16
+#define TABLE_MINIMUM_CAPACITY  16
+#define TABLE_LOAD_NUMERATOR    7      // Grows once more than 7/8 of the slots are used.
+#define TABLE_LOAD_DENOMINATOR  8
+#define TABLE_MAXIMUM_ALIGNMENT 16
+
+
+typedef struct {
+    allocator_t allocator;
+    int         arena;
+    byte_t*     m_storage;
+    u8*         m_control;
+    u32*        m_hashes;
+    byte_t*     m_keys;
+    byte_t*     m_values;
+    u32         m_count;
+    u32         m_capacity;     // A power of two, or 0 before the first insert.
+    u32         m_key_size;
+    u32         m_value_size;
+} table_t;
+
+// Compares a stored key with a key being looked up, which doesn't need to have the same type.
+typedef int (*table_equal_fn)(const void* stored_key, const void* key, u32 key_size);
+
+
+table_t table_init(allocator_t allocator, u32 key_size, u32 value_size, int arena) {
+    ASSERTF(key_size > 0, "Key size must be positive!");
+    return (table_t) {
+            .allocator    = allocator,
+            .arena        = arena,
+            .m_key_size   = key_size,
+            .m_value_size = value_size,
+    };
+}
+
+// Keys and values are aligned to TABLE_MAXIMUM_ALIGNMENT at most.
+#define table_init_type(allocator, key_type, value_type, arena) table_init(allocator, sizeof(key_type), sizeof(value_type), arena)
+
+#define table_key(table, type_, slot)    (((type_*) (table)->m_keys)[slot])
+#define table_value(table, type_, slot)  (((type_*) (table)->m_values)[slot])
+#define table_slot_used(table, slot)     ((table)->m_control[slot] != 0)
+
+
+// FNV-1a, folded to 32 bits so the top bits used for the control byte are well mixed.
+u32 table_hash(const void* bytes, size_t size) {
+    u64 hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= ((const u8*) bytes)[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return (u32) (hash ^ (hash >> 32));
+}
+
+
+// A bit for every control byte in the group at `control` that equals `tag`.
+u32 table_match(const u8* control, u8 tag) {
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i*) control);
+    return (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) tag)));
+#else
+    u32 mask = 0;
+    for (u32 i = 0; i < TABLE_GROUP_SIZE; ++i)
+        mask |= (u32) (control[i] == tag) << i;
+    return mask;
+#endif
+}
+
+u8 table_tag(u32 hash) {
+    return (u8) (0x80 | (hash >> 25));
+}
+
+void table_set_control(table_t* table, u32 slot, u8 tag) {
+    table->m_control[slot] = tag;
+    if (slot < TABLE_GROUP_SIZE - 1)
+        table->m_control[table->m_capacity + slot] = tag;
+}
+
+
+int table_equal_bytes(const void* stored_key, const void* key, u32 key_size) {
+    return memcmp(stored_key, key, key_size) == 0;
+}
+
+// Returns the slot of the key, or -1 with `empty_slot` set to where it would be inserted.
+i64 table_probe(table_t* table, u32 hash, const void* key, table_equal_fn equal, u32* empty_slot) {
+    if (table->m_capacity == 0) {
+        return -1;
+    }
+    u32 mask = table->m_capacity - 1;
+    u8  tag  = table_tag(hash);
+    for (u32 probe = 0; probe < table->m_capacity; probe += TABLE_GROUP_SIZE) {
+        u32 start   = (hash + probe) & mask;
+        u32 matches = table_match(table->m_control + start, tag);
+        u32 empties = table_match(table->m_control + start, 0);
+
+        // Anything after the first empty slot belongs to another chain.
+        u32 before_empty = (empties == 0) ? 0xFFFF : (empties & -empties) - 1;
+        matches &= before_empty;
+        while (matches != 0) {
+            u32 slot = (start + (u32) __builtin_ctz(matches)) & mask;
+            if (table->m_hashes[slot] == hash && equal(table->m_keys + (size_t) slot * table->m_key_size, key, table->m_key_size))
+                return slot;
+            matches &= matches - 1;
+        }
+        if (empties != 0) {
+            if (empty_slot != 0)
+                *empty_slot = (start + (u32) __builtin_ctz(empties)) & mask;
+            return -1;
+        }
+    }
+    ASSERTF(0, "The table is full!");
+    return -1;
+}
+
+
+size_t table_storage_size(u32 capacity, u32 key_size, u32 value_size, size_t* hashes_offset, size_t* keys_offset, size_t* values_offset) {
+    *hashes_offset = align_address(capacity + TABLE_GROUP_SIZE, TABLE_MAXIMUM_ALIGNMENT);
+    *keys_offset   = align_address(*hashes_offset + (size_t) capacity * sizeof(u32), TABLE_MAXIMUM_ALIGNMENT);
+    *values_offset = align_address(*keys_offset + (size_t) capacity * key_size, TABLE_MAXIMUM_ALIGNMENT);
+    return *values_offset + (size_t) capacity * value_size;
+}
+
+
+allocation_result_t table_set_capacity(table_t* table, u32 capacity) {
+    ASSERTF(is_power_of_two(capacity) && capacity >= TABLE_MINIMUM_CAPACITY, "Capacity must be a power of two of at least %d!", TABLE_MINIMUM_CAPACITY);
+    size_t hashes_offset, keys_offset, values_offset;
+    size_t size = table_storage_size(capacity, table->m_key_size, table->m_value_size, &hashes_offset, &keys_offset, &values_offset);
+
+    byte_t* storage = nax_allocate_aligned(table->allocator, (word_t) size, TABLE_MAXIMUM_ALIGNMENT);
+    if (!allocation_succeeded(storage)) {
+        return make_allocation_error((allocation_status_t)(size_t) storage);
+    }
+    memset(storage, 0, capacity + TABLE_GROUP_SIZE);
+
+    table_t old = *table;
+    table->m_storage  = storage;
+    table->m_control  = storage;
+    table->m_hashes   = (u32*) (storage + hashes_offset);
+    table->m_keys     = storage + keys_offset;
+    table->m_values   = storage + values_offset;
+    table->m_capacity = capacity;
+
+    // The hashes are stored, so moving an entry never hashes its key again.
+    u32 mask = capacity - 1;
+    for (u32 slot = 0; slot < old.m_capacity; ++slot) {
+        if (old.m_control[slot] == 0)
+            continue;
+        u32 hash   = old.m_hashes[slot];
+        u32 target = hash & mask;
+        while (table->m_control[target] != 0)
+            target = (target + 1) & mask;
+        table_set_control(table, target, old.m_control[slot]);
+        table->m_hashes[target] = hash;
+        memcpy(table->m_keys   + (size_t) target * table->m_key_size,   old.m_keys   + (size_t) slot * old.m_key_size,   table->m_key_size);
+        memcpy(table->m_values + (size_t) target * table->m_value_size, old.m_values + (size_t) slot * old.m_value_size, table->m_value_size);
+    }
+
+    if (old.m_storage != 0 && !table->arena) {
+        nax_free(table->allocator, old.m_storage);
+    }
+    return make_allocation_result(storage);
+}
+
+
+allocation_result_t table_reserve(table_t* table, u32 count) {
+    if ((u64) count * TABLE_LOAD_DENOMINATOR <= (u64) table->m_capacity * TABLE_LOAD_NUMERATOR) {
+        return (allocation_result_t) { .memory=table->m_storage };
+    }
+    u32 capacity = (table->m_capacity == 0) ? TABLE_MINIMUM_CAPACITY : table->m_capacity;
+    while ((u64) count * TABLE_LOAD_DENOMINATOR > (u64) capacity * TABLE_LOAD_NUMERATOR)
+        capacity *= 2;
+    return table_set_capacity(table, capacity);
+}
+
+
+// Finds the slot of a key with a custom comparison, or -1.
+i64 table_find_with(table_t* table, u32 hash, const void* key, table_equal_fn equal) {
+    return table_probe(table, hash, key, equal, 0);
+}
+
+// Returns the value of the key, or 0 if it's not in the table.
+void* table_find(table_t* table, const void* key) {
+    i64 slot = table_probe(table, table_hash(key, table->m_key_size), key, table_equal_bytes, 0);
+    return (slot < 0) ? 0 : table->m_values + (size_t) slot * table->m_value_size;
+}
+
+
+// Inserts a slot for the key, or finds the existing one. Returns the slot through `slot_out`
+// and whether it was inserted through `inserted`; keys and values of new slots are left to the caller.
+allocation_result_t table_insert_slot(table_t* table, u32 hash, const void* key, table_equal_fn equal, u32* slot_out, int* inserted) {
+    u32 empty_slot = 0;
+    i64 slot = table_probe(table, hash, key, equal, &empty_slot);
+    if (slot >= 0) {
+        *slot_out = (u32) slot;
+        *inserted = 0;
+        return (allocation_result_t) { .memory=table->m_storage };
+    }
+
+    if ((u64) (table->m_count + 1) * TABLE_LOAD_DENOMINATOR > (u64) table->m_capacity * TABLE_LOAD_NUMERATOR) {
+        allocation_result_t result = table_reserve(table, table->m_count + 1);
+        if (!allocation_succeeded(result.memory))
+            return result;
+        table_probe(table, hash, key, equal, &empty_slot);
+    }
+
+    table_set_control(table, empty_slot, table_tag(hash));
+    table->m_hashes[empty_slot] = hash;
+    table->m_count += 1;
+    *slot_out = empty_slot;
+    *inserted = 1;
+    return (allocation_result_t) { .memory=table->m_storage };
+}
+
+// Inserts or overwrites the key's value, copied from `value` if it's not null. Returns the value.
+allocation_result_t table_insert(table_t* table, const void* key, const void* value) {
+    u32 slot     = 0;
+    int inserted = 0;
+    allocation_result_t result = table_insert_slot(table, table_hash(key, table->m_key_size), key, table_equal_bytes, &slot, &inserted);
+    if (!allocation_succeeded(result.memory)) {
+        return result;
+    }
+    if (inserted) {
+        memcpy(table->m_keys + (size_t) slot * table->m_key_size, key, table->m_key_size);
+    }
+    byte_t* destination = table->m_values + (size_t) slot * table->m_value_size;
+    if (value != 0) {
+        memcpy(destination, value, table->m_value_size);
+    }
+    return make_allocation_result(destination);
+}
+
+
+// Removes the entry at `slot` and shifts the rest of its chain back into the hole.
+void table_remove_slot(table_t* table, u32 slot) {
+    u32 mask = table->m_capacity - 1;
+    u32 hole = slot;
+    u32 next = slot;
+    for (;;) {
+        next = (next + 1) & mask;
+        if (table->m_control[next] == 0)
+            break;
+        u32 home = table->m_hashes[next] & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table_set_control(table, hole, table->m_control[next]);
+            table->m_hashes[hole] = table->m_hashes[next];
+            memcpy(table->m_keys   + (size_t) hole * table->m_key_size,   table->m_keys   + (size_t) next * table->m_key_size,   table->m_key_size);
+            memcpy(table->m_values + (size_t) hole * table->m_value_size, table->m_values + (size_t) next * table->m_value_size, table->m_value_size);
+            hole = next;
+        }
+    }
+    table_set_control(table, hole, 0);
+    table->m_count -= 1;
+}
+
+int table_remove(table_t* table, const void* key) {
+    i64 slot = table_probe(table, table_hash(key, table->m_key_size), key, table_equal_bytes, 0);
+    if (slot < 0) {
+        return 0;
+    }
+    table_remove_slot(table, (u32) slot);
+    return 1;
+}
+
+
+// Removes every entry but keeps the storage.
+void table_clear(table_t* table) {
+    if (table->m_capacity != 0)
+        memset(table->m_control, 0, table->m_capacity + TABLE_GROUP_SIZE);
+    table->m_count = 0;
+}
+
+// Forgets the storage without freeing it, for when the arena it came from has been rewound.
+void table_reset(table_t* table) {
+    table->m_storage  = 0;
+    table->m_control  = 0;
+    table->m_hashes   = 0;
+    table->m_keys     = 0;
+    table->m_values   = 0;
+    table->m_count    = 0;
+    table->m_capacity = 0;
+}
+
+void table_free(table_t* table) {
+    if (table->m_storage != 0)
+        nax_free(table->allocator, table->m_storage);
+    table_reset(table);
+}